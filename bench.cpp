@@ -0,0 +1,352 @@
+// End-to-end benchmark for libhuffman. Compresses and decompresses a few kinds
+// of generated input through huffcontext, a call at a time, and reports
+// throughput, cycles per byte and per-call latency percentiles as JSON.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h> // __rdtsc
+#define BENCH_HAVE_TSC 1
+#else
+#define BENCH_HAVE_TSC 0
+#endif
+
+#include "libhuffman.h"
+
+using namespace std;
+
+/* bytes in each generated corpus, unless --size says otherwise */
+#define BENCH_SIZE (16 << 20)
+/* bytes in the large corpus made with --large */
+#define BENCH_LARGESIZE ((size_t)1 << 30)
+/* bytes handed to each compress call, unless --call-size says otherwise */
+#define BENCH_CALLSIZE (1 << 20)
+/* keep repeating each measurement for at least this long */
+#define BENCH_SECONDS 0.5
+
+/// \brief a generated input to time the coders over
+///
+/// a generated input to time the coders over
+struct corpus
+{
+	/// \brief what kind of input it is
+	///
+	/// what kind of input it is, see generate
+	string name;
+	/// \brief the input itself
+	///
+	/// the input itself
+	vector<uint8_t> data;
+};
+
+/// \brief the timings of one direction (encode or decode) over a corpus
+///
+/// the timings of one direction (encode or decode) over a corpus
+struct timing
+{
+	/// \brief number of calls timed
+	///
+	/// number of calls timed
+	size_t calls = 0;
+	/// \brief megabytes (of uncompressed data) per second
+	///
+	/// megabytes (10^6 bytes, of uncompressed data) per second
+	double mbps = 0;
+	/// \brief time stamp counter ticks per uncompressed byte
+	///
+	/// time stamp counter ticks per uncompressed byte, or -1 without one
+	double cpb = -1;
+	/// \brief median call latency in microseconds
+	///
+	/// median call latency in microseconds
+	double p50 = 0;
+	/// \brief 99th percentile call latency in microseconds
+	///
+	/// 99th percentile call latency in microseconds
+	double p99 = 0;
+};
+
+// reads the time stamp counter, or 0 if there isn't one
+static uint64_t ticks()
+{
+#if BENCH_HAVE_TSC
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+// fills `c` with `n` bytes of input of the kind named by c.name
+static void generate(corpus& c, size_t n)
+{
+	mt19937 rng(1);
+
+	c.data.resize(n);
+	if (c.name == "random")
+	{
+		for (size_t i = 0; i < n; i++)
+			c.data[i] = rng();
+	}
+	else if (c.name == "zipf")
+	{
+		/* byte r + 1 is 1/(r + 1) as likely as the most common byte */
+		vector<double> weights(256);
+		for (int r = 0; r < 256; r++)
+			weights[r] = 1.0 / pow(r + 1, 1.1);
+		discrete_distribution<int> zipf(weights.begin(), weights.end());
+		for (size_t i = 0; i < n; i++)
+			c.data[i] = zipf(rng);
+	}
+	else if (c.name == "text" or c.name == "large")
+	{
+		/* letters weighted roughly like English, with spaces and newlines */
+		const char* letters = "eeeeeeeeeeeetttttttttaaaaaaaaoooooooiiiiiii"
+		                      "nnnnnnnsssssshhhhhhrrrrrrddddlllluuucccmmmww"
+		                      "ffggyyppbbvk      \n";
+		size_t count = strlen(letters);
+		for (size_t i = 0; i < n; i++)
+			c.data[i] = letters[rng() % count];
+	}
+	else /* "single": one byte over and over, like singlebyte.txt */
+		memset(c.data.data(), 'a', n);
+}
+
+// turns the per-call latencies (in ns) and totals into a timing
+static timing summarize(vector<double>& latencies, size_t bytes,
+                        double seconds, uint64_t elapsed)
+{
+	timing t;
+
+	sort(latencies.begin(), latencies.end());
+	t.calls = latencies.size();
+	t.mbps = bytes / seconds / 1e6;
+	t.cpb = BENCH_HAVE_TSC ? (double)elapsed / bytes : -1;
+	t.p50 = latencies[latencies.size() / 2] / 1e3;
+	t.p99 = latencies[min(latencies.size() - 1,
+	                      latencies.size() * 99 / 100)] / 1e3;
+
+	return t;
+}
+
+// calls `call` on each `callsize`-byte piece of `n` bytes, over and over
+// until BENCH_SECONDS have passed (and at least once), timing each call
+template <typename F>
+static timing timeCalls(size_t n, size_t callsize, double minseconds, F call)
+{
+	using clock = chrono::steady_clock;
+	vector<double> latencies;
+	size_t bytes = 0;
+	double seconds = 0;
+	uint64_t elapsed = 0;
+
+	while (seconds < minseconds or latencies.empty())
+	{
+		for (size_t pos = 0; pos < n; pos += callsize)
+		{
+			size_t len = min(callsize, n - pos);
+			auto start = clock::now();
+			uint64_t t0 = ticks();
+
+			call(pos, len);
+
+			elapsed += ticks() - t0;
+			double ns = chrono::duration<double, nano>(clock::now() - start)
+			            .count();
+			latencies.push_back(ns);
+			seconds += ns / 1e9;
+			bytes += len;
+		}
+	}
+
+	return summarize(latencies, bytes, seconds, elapsed);
+}
+
+// writes a timing as a JSON object
+static void printTiming(const timing& t)
+{
+	cout << "{\"calls\": " << t.calls << ", \"mb_per_s\": " << t.mbps
+	     << ", \"cycles_per_byte\": ";
+	if (t.cpb < 0)
+		cout << "null";
+	else
+		cout << t.cpb;
+	cout << ", \"p50_us\": " << t.p50 << ", \"p99_us\": " << t.p99 << "}";
+}
+
+// parses a size such as "4096", "64K" or "1M" (binary multiples), returns 0
+// if it isn't a valid size
+static size_t parseSize(const char* s)
+{
+	char* end;
+	unsigned long long size = strtoull(s, &end, 10);
+
+	switch (*end)
+	{
+		case 'G': case 'g': size <<= 10; /* fall through */
+		case 'M': case 'm': size <<= 10; /* fall through */
+		case 'K': case 'k': size <<= 10; end++; break;
+		case '\0': break;
+		default: return 0;
+	}
+
+	return (*end == '\0' and end != s) ? size : 0;
+}
+
+static void usage()
+{
+	cerr << "Usage: bench [--size N] [--call-size N] [--block-size N]"
+	        " [--seconds S]\n             [--large] [--corpus NAME]\n"
+	        "\nTimes compress and decompress over generated corpora (random,"
+	        " zipf, text,\nsingle, and with --large a 1G text corpus) and"
+	        " writes the results to stdout\nas JSON.\n";
+}
+
+int main(int argc, char** argv)
+{
+	size_t size = BENCH_SIZE;
+	size_t callsize = BENCH_CALLSIZE;
+	size_t blocksize = BLOCK_DEFAULTSIZE;
+	double minseconds = BENCH_SECONDS;
+	bool large = false;
+	string only;
+
+	for (int i = 1; i < argc; i++)
+	{
+		string arg = argv[i];
+
+		if (arg == "--size" and i + 1 < argc)
+			size = parseSize(argv[++i]);
+		else if (arg == "--call-size" and i + 1 < argc)
+			callsize = parseSize(argv[++i]);
+		else if (arg == "--block-size" and i + 1 < argc)
+			blocksize = parseSize(argv[++i]);
+		else if (arg == "--seconds" and i + 1 < argc)
+			minseconds = atof(argv[++i]);
+		else if (arg == "--large")
+			large = true;
+		else if (arg == "--corpus" and i + 1 < argc)
+			only = argv[++i];
+		else
+		{
+			usage();
+			return 1;
+		}
+	}
+
+	if (size == 0 or callsize == 0 or blocksize == 0
+	    or blocksize > BLOCK_MAXSIZE)
+	{
+		cerr << "E: sizes must be positive, and blocks at most "
+		     << (BLOCK_MAXSIZE >> 20) << "M\n";
+		return 1;
+	}
+
+	vector<string> names = {"random", "zipf", "text", "single"};
+	if (large)
+		names.push_back("large");
+
+	struct
+	{
+		const char* name;
+		bool interleave;
+		bool context;
+		bool runs;
+		uint8_t transforms;
+	} modes[] = {
+		{"framed", false, false, false, 0},
+		{"interleaved", true, false, false, 0},
+		{"context", false, true, false, 0},
+		{"runs", false, false, true, 0},
+		{"bwt", false, false, false, BLOCK_BWT | BLOCK_MTF},
+	};
+
+	cout << fixed << setprecision(3);
+	cout << "{\n  \"settings\": {\"size\": " << size << ", \"call_size\": "
+	     << callsize << ", \"block_size\": " << blocksize
+	     << ", \"seconds\": " << minseconds << ", \"tsc\": "
+	     << (BENCH_HAVE_TSC ? "true" : "false") << "},\n  \"results\": [";
+
+	bool first = true;
+	for (auto& name : names)
+	{
+		if (not only.empty() and only != name)
+			continue;
+
+		corpus c;
+		c.name = name;
+		cerr << "generating " << name << "...\n";
+		generate(c, name == "large" ? BENCH_LARGESIZE : size);
+		size_t n = c.data.size();
+
+		for (auto& mode : modes)
+		{
+			huffcontext ctx(15, blocksize, mode.interleave, false,
+			                mode.context, 8, mode.runs, mode.transforms);
+			size_t calls = (n + callsize - 1) / callsize;
+			vector<uint8_t> packed(calls * ctx.compressBound(callsize));
+			vector<size_t> start(calls + 1);
+			vector<size_t> packedsize(calls);
+			vector<uint8_t> out(n);
+			bool failed = false;
+
+			/* every call's output gets a slot big enough for the worst case */
+			for (size_t i = 0; i <= calls; i++)
+				start[i] = i * ctx.compressBound(callsize);
+
+			cerr << name << " " << mode.name << "...\n";
+			timing enc = timeCalls(n, callsize, minseconds,
+			                       [&](size_t pos, size_t len)
+			{
+				size_t i = pos / callsize;
+				long got = ctx.compress(c.data.data() + pos, len,
+				                        packed.data() + start[i],
+				                        start[i + 1] - start[i]);
+				failed = failed or got < 0;
+				packedsize[i] = got;
+			});
+
+			timing dec = timeCalls(n, callsize, minseconds,
+			                       [&](size_t pos, size_t len)
+			{
+				size_t i = pos / callsize;
+				long got = ctx.decompress(packed.data() + start[i],
+				                          packedsize[i], out.data() + pos, len);
+				failed = failed or got != (long)len;
+			});
+
+			if (failed or out != c.data)
+			{
+				cerr << "Error: " << name << " " << mode.name
+				     << " didn't round-trip\n";
+				return 2;
+			}
+
+			size_t total = 0;
+			for (size_t s : packedsize)
+				total += s;
+
+			cout << (first ? "" : ",") << "\n    {\"corpus\": \"" << name
+			     << "\", \"mode\": \"" << mode.name << "\", \"bytes\": " << n
+			     << ", \"compressed\": " << total << ", \"ratio\": "
+			     << (double)total / n << ",\n     \"encode\": ";
+			printTiming(enc);
+			cout << ",\n     \"decode\": ";
+			printTiming(dec);
+			cout << "}";
+			first = false;
+		}
+	}
+
+	cout << "\n  ]\n}\n";
+
+	return 0;
+}
@@ -0,0 +1,182 @@
+/// \file bitio.h
+/// \brief defines the bit-level readers and writers used by the coders
+///
+/// This file defines small, inlined helpers for moving bits in and out of
+/// memory. The bitstream layout matches the rest of the program: the first bit
+/// of the stream lives in bit 0 of byte 0, the next in bit 1, and so on.
+
+
+#ifndef BITIO_H
+#define BITIO_H
+
+#include <cstdint>
+#include <cstring>
+
+using std::uint8_t;
+using std::uint64_t;
+
+/// \brief loads 8 bytes from (possibly unaligned) memory, little-endian
+///
+/// loads 8 bytes from (possibly unaligned) memory as a little-endian integer,
+/// so that the byte at `p` ends up in the least significant bits.
+inline uint64_t load64(const uint8_t* p)
+{
+	uint64_t v;
+	std::memcpy(&v, p, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	v = __builtin_bswap64(v);
+#endif
+	return v;
+}
+
+/// \brief stores 8 bytes to (possibly unaligned) memory, little-endian
+///
+/// stores 8 bytes to (possibly unaligned) memory as a little-endian integer,
+/// so that the least significant bits end up in the byte at `p`.
+inline void store64(uint8_t* p, uint64_t v)
+{
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	v = __builtin_bswap64(v);
+#endif
+	std::memcpy(p, &v, sizeof(v));
+}
+
+/// \brief loads a symbol of type `symbol_t` from memory, little-endian
+///
+/// loads a byte, or a wider symbol stored little-endian, from (possibly
+/// unaligned) memory at `p`
+template <typename symbol_t>
+inline symbol_t loadSymbol(const uint8_t* p)
+{
+	symbol_t v = 0;
+	for (unsigned i = 0; i < sizeof(symbol_t); i++)
+		v |= (symbol_t)(p[i] << (8 * i));
+	return v;
+}
+
+/// \brief stores a symbol of type `symbol_t` to memory, little-endian
+///
+/// stores a byte, or a wider symbol little-endian, to (possibly unaligned)
+/// memory at `p`
+template <typename symbol_t>
+inline void storeSymbol(uint8_t* p, symbol_t v)
+{
+	for (unsigned i = 0; i < sizeof(symbol_t); i++)
+		p[i] = (uint8_t)(v >> (8 * i));
+}
+
+/// \brief reads bits out of a region of memory, least significant bit first
+///
+/// keeps between 56 and 63 bits of lookahead in a 64-bit accumulator, so that
+/// any code up to 56 bits long can be peeked at and consumed with one refill.
+/// Reading past `end` yields zero bits, so callers must track how many bits
+/// are actually valid.
+struct bitreader
+{
+	/// \brief next byte to be shifted into the accumulator
+	///
+	/// next byte to be shifted into the accumulator
+	const uint8_t* pos;
+	/// \brief one past the last readable byte
+	///
+	/// one past the last readable byte
+	const uint8_t* end;
+	/// \brief buffered bits, next bit to read in the least significant bit
+	///
+	/// buffered bits, next bit to read in the least significant bit
+	uint64_t acc;
+	/// \brief number of valid bits in `acc`
+	///
+	/// number of valid bits in `acc`
+	unsigned count;
+
+	/// \brief tops the accumulator up to at least 56 bits
+	///
+	/// tops the accumulator up to at least 56 bits, loading 8 bytes at a time
+	/// when there are enough left and falling back to single bytes (then
+	/// zeros) near the end of the region.
+	void refill()
+	{
+		if (end - pos >= 8)
+		{
+			acc |= load64(pos) << count;
+			pos += (63 - count) >> 3;
+			count |= 56;
+			return;
+		}
+
+		while (count <= 56)
+		{
+			acc |= (uint64_t)(pos < end ? *pos++ : 0) << count;
+			count += 8;
+		}
+	}
+
+	/// \brief drops `n` bits from the front of the accumulator
+	///
+	/// drops `n` bits from the front of the accumulator. `n` must not exceed
+	/// `count`.
+	void consume(unsigned n)
+	{
+		acc >>= n;
+		count -= n;
+	}
+};
+
+/// \brief writes bits into a region of memory, least significant bit first
+///
+/// collects bits in a 64-bit accumulator and stores them 8 bytes at a time
+/// once it fills up. The caller must make sure there is room at `pos` for
+/// every whole 8-byte word that gets stored.
+struct bitwriter
+{
+	/// \brief where the next full accumulator will be stored
+	///
+	/// where the next full accumulator will be stored
+	uint8_t* pos;
+	/// \brief pending bits, first bit written in the least significant bit
+	///
+	/// pending bits, first bit written in the least significant bit
+	uint64_t acc;
+	/// \brief number of pending bits in `acc`, always less than 64
+	///
+	/// number of pending bits in `acc`, always less than 64
+	unsigned count;
+
+	/// \brief appends the low `n` bits of `bits` to the stream
+	///
+	/// appends the low `n` bits of `bits` (1 to 64 of them, first bit least
+	/// significant) to the stream. Any higher bits of `bits` must be clear.
+	void put(uint64_t bits, unsigned n)
+	{
+		acc |= bits << count;
+		if (count + n < 64)
+		{
+			count += n;
+			return;
+		}
+
+		/* accumulator is full: store it and keep whatever didn't fit */
+		store64(pos, acc);
+		pos += 8;
+		acc = count ? bits >> (64 - count) : 0;
+		count = count + n - 64;
+	}
+
+	/// \brief stores the pending bits, zero-padded out to a whole byte
+	///
+	/// stores the pending bits, zero-padded out to a whole byte, and returns
+	/// how many padding bits were added (0 to 7).
+	unsigned flush()
+	{
+		unsigned padbits = (8 - (count & 7)) & 7;
+		for (; count > 0; count = (count > 8 ? count - 8 : 0))
+		{
+			*pos++ = (uint8_t)acc;
+			acc >>= 8;
+		}
+		return padbits;
+	}
+};
+
+#endif /* BITIO_H */
@@ -0,0 +1,199 @@
+#include "canonical.h"
+
+/* packed length bytes:                                                   */
+/*   0x01 - 0x3f   the next symbol's code length                          */
+/*   0x40 | n      the next n+1 symbols have the same length as the last  */
+/*   0x80 | n      the next n+1 symbols are unused (length 0)             */
+#define PACK_REPEAT 0x40
+#define PACK_ZEROS  0x80
+#define PACK_MAXREPEAT 64
+#define PACK_MAXZEROS 128
+
+
+// recursively records the depth of every leaf below `root`
+static void fillLengths(uint8_t* lengths, size_t n, node* root, uint8_t depth)
+{
+	if (root == nullptr)
+		return;
+
+	if (root->isLeaf())
+	{
+		/* a lone leaf at the root means there are no codes at all */
+		if (depth > 0 and root->ch < n)
+			lengths[root->ch] = depth;
+		return;
+	}
+
+	fillLengths(lengths, n, root->left, depth + 1);
+	fillLengths(lengths, n, root->right, depth + 1);
+}
+
+// fills the first `n` entries of `lengths` with the depth of the matching leaf
+// in the tree at `root`, or 0 for symbols that aren't in the tree
+void getLengthsFromTree(uint8_t* lengths, size_t n, node* root)
+{
+	for (size_t i = 0; i < n; i++)
+		lengths[i] = 0;
+
+	fillLengths(lengths, n, root, 0);
+}
+
+// returns true if the `n` code lengths are within CANON_MAXBITS and satisfy
+// the Kraft inequality, i.e. they describe a valid prefix code
+bool checkLengths(const uint8_t* lengths, size_t n)
+{
+	/* sum of 2^-length, scaled up by 2^CANON_MAXBITS */
+	uint64_t kraft = 0;
+
+	for (size_t i = 0; i < n; i++)
+	{
+		if (lengths[i] > CANON_MAXBITS)
+			return false;
+		if (lengths[i])
+			kraft += (uint64_t)1 << (CANON_MAXBITS - lengths[i]);
+
+		/* checked every time, so the sum can't overflow */
+		if (kraft > ((uint64_t)1 << CANON_MAXBITS))
+			return false;
+	}
+
+	return true;
+}
+
+// fills `map` with the canonical code for each of the `n` symbols, in which
+// shorter codes come first and codes of equal length are ordered by symbol
+void getCanonicalMap(huffcode_t* map, const uint8_t* lengths, size_t n)
+{
+	/* number of codes of each length, and the first code of each length */
+	uint64_t count[CANON_MAXBITS + 1] = {0};
+	uint64_t next[CANON_MAXBITS + 1] = {0};
+
+	for (size_t i = 0; i < n; i++)
+		count[lengths[i]]++;
+	count[0] = 0;
+
+	/* the first code of each length follows on from the last code of the */
+	/* length before it, with a 0 appended */
+	for (int len = 1; len <= CANON_MAXBITS; len++)
+		next[len] = (next[len - 1] + count[len - 1]) << 1;
+
+	/* hand out codes in symbol order within each length */
+	for (size_t i = 0; i < n; i++)
+	{
+		map[i].bitcnt = lengths[i];
+		map[i].bits = lengths[i] ? next[lengths[i]]++ : 0;
+	}
+}
+
+// builds a code tree which matches the codes in `map`, so that the tree based
+// decoders can be used with canonical codes
+node* getTreeFromMap(const huffcode_t* map, size_t n, nodearena* arena)
+{
+	node* root = arena ? arena->alloc() : new node{nullptr, nullptr, 0, 0};
+
+	for (size_t i = 0; i < n and root != nullptr; i++)
+	{
+		node* traverse = root;
+
+		if (map[i].bitcnt == 0)
+			continue;
+
+		/* follow (or make) the path for the code, first bit first */
+		for (int b = map[i].bitcnt - 1; b >= 0; b--)
+		{
+			node*& child = ((map[i].bits >> b) & 0x1) ? traverse->right
+			                                          : traverse->left;
+			if (child == nullptr)
+				child = arena ? arena->alloc() : new node{nullptr, nullptr, 0, 0};
+			if (child == nullptr)
+				return nullptr;
+			traverse = child;
+		}
+
+		traverse->ch = static_cast<uint16_t>(i);
+	}
+
+	return root;
+}
+
+// writes the packed form of `lengths` to `out` (which must have room for `n`
+// bytes) and returns the number of bytes written
+size_t packLengths(const uint8_t* lengths, size_t n, uint8_t* out)
+{
+	size_t outlen = 0;
+	size_t i = 0;
+
+	while (i < n)
+	{
+		size_t run = 1;
+
+		/* runs of unused symbols */
+		if (lengths[i] == 0)
+		{
+			while (i + run < n and lengths[i + run] == 0 and run < PACK_MAXZEROS)
+				run++;
+			out[outlen++] = PACK_ZEROS | (run - 1);
+			i += run;
+			continue;
+		}
+
+		/* a length, followed by however many times it repeats */
+		out[outlen++] = lengths[i];
+		run = 0;
+		while (i + 1 + run < n and lengths[i + 1 + run] == lengths[i]
+		       and run < PACK_MAXREPEAT)
+			run++;
+		if (run > 0)
+			out[outlen++] = PACK_REPEAT | (run - 1);
+		i += 1 + run;
+	}
+
+	return outlen;
+}
+
+// reads packed code lengths from the `avail` bytes at `in` into the `n`
+// entries of `lengths`, returns the number of bytes read, or 0 if the packed
+// data is malformed or incomplete
+size_t unpackLengths(const uint8_t* in, size_t avail, uint8_t* lengths, size_t n)
+{
+	size_t inlen = 0;
+	size_t i = 0;
+
+	while (i < n)
+	{
+		if (inlen >= avail)
+			return 0;
+
+		uint8_t b = in[inlen++];
+		size_t run = 1;
+		uint8_t len;
+
+		if (b & PACK_ZEROS)
+		{
+			run = (b & (PACK_ZEROS - 1)) + 1;
+			len = 0;
+		}
+		else if (b & PACK_REPEAT)
+		{
+			/* can't repeat a length before there is one */
+			if (i == 0 or lengths[i - 1] == 0)
+				return 0;
+			run = (b & (PACK_REPEAT - 1)) + 1;
+			len = lengths[i - 1];
+		}
+		else if (b != 0)
+			len = b;
+		else
+			return 0;
+
+		if (i + run > n)
+			return 0;
+		while (run--)
+			lengths[i++] = len;
+	}
+
+	if (not checkLengths(lengths, n))
+		return 0;
+
+	return inlen;
+}
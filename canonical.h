@@ -0,0 +1,68 @@
+/// \file canonical.h
+/// \brief defines canonical Huffman codes and their packed code-length format
+///
+/// A canonical Huffman code is fully determined by the length of each
+/// symbol's code: codes are handed out in increasing numeric order, sorted by
+/// length and then by symbol. This file defines how those codes are built from
+/// lengths, and how the lengths are packed into a small header.
+
+
+#ifndef CANONICAL_H
+#define CANONICAL_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "huffcode.h"
+#include "node.h"
+
+using std::size_t;
+using std::uint8_t;
+
+/// \brief longest code length the packed length format can represent
+#define CANON_MAXBITS 63
+/// \brief largest number of bytes packLengths can produce for 256 symbols
+#define CANON_MAXHEADER 256
+
+/// \brief fills `lengths` with the code length of each leaf of a code tree
+///
+/// fills the first `n` entries of `lengths` with the depth of the matching
+/// leaf in the tree at `root`, or 0 for symbols that aren't in the tree
+void getLengthsFromTree(uint8_t* lengths, size_t n, node* root);
+
+/// \brief checks that `lengths` can form a prefix code
+///
+/// returns true if the `n` code lengths are within CANON_MAXBITS and satisfy
+/// the Kraft inequality, i.e. they describe a valid prefix code
+bool checkLengths(const uint8_t* lengths, size_t n);
+
+/// \brief assigns canonical codes to `n` symbols from their code lengths
+///
+/// fills `map` with the canonical code for each of the `n` symbols, in which
+/// shorter codes come first and codes of equal length are ordered by symbol.
+/// symbols with a length of 0 get an empty code.
+void getCanonicalMap(huffcode_t* map, const uint8_t* lengths, size_t n);
+
+/// \brief builds a code tree which matches the codes in `map`
+///
+/// builds a code tree which matches the codes in `map`, so that the tree based
+/// decoders can be used with canonical codes. clean up with cleanTree, or if
+/// the nodes came from `arena`, by resetting it. returns nullptr if the tree
+/// needs more nodes than `arena` has left (which a complete code never does)
+node* getTreeFromMap(const huffcode_t* map, size_t n,
+                     nodearena* arena = nullptr);
+
+/// \brief packs `n` code lengths into a compact run-length coded header
+///
+/// writes the packed form of `lengths` to `out` (which must have room for `n`
+/// bytes) and returns the number of bytes written
+size_t packLengths(const uint8_t* lengths, size_t n, uint8_t* out);
+
+/// \brief inverse of packLengths
+///
+/// reads packed code lengths from the `avail` bytes at `in` into the `n`
+/// entries of `lengths`, returns the number of bytes read, or 0 if the packed
+/// data is malformed or incomplete
+size_t unpackLengths(const uint8_t* in, size_t avail, uint8_t* lengths, size_t n);
+
+#endif /* CANONICAL_H */
@@ -0,0 +1,1078 @@
+#include <algorithm>
+#include <cstring>
+
+#include "canonical.h"
+#include "container.h"
+#include "context.h"
+#include "histogram.h"
+#include "huffcode.h"
+#include "metrics.h"
+#include "node.h"
+#include "runs.h"
+#include "tables.h"
+#include "transform.h"
+
+
+// stores `v` at `out`, little-endian
+static void putU32(uint8_t* out, uint32_t v)
+{
+	for (int i = 0; i < 4; i++)
+		out[i] = (uint8_t)(v >> (8 * i));
+}
+
+// loads a little-endian value from `in`
+static uint32_t getU32(const uint8_t* in)
+{
+	uint32_t v = 0;
+	for (int i = 0; i < 4; i++)
+		v |= (uint32_t)in[i] << (8 * i);
+	return v;
+}
+
+// stores `v` at `out`, little-endian
+static void putU64(uint8_t* out, uint64_t v)
+{
+	putU32(out, (uint32_t)v);
+	putU32(out + 4, (uint32_t)(v >> 32));
+}
+
+// loads a little-endian value from `in`
+static uint64_t getU64(const uint8_t* in)
+{
+	return getU32(in) | (uint64_t)getU32(in + 4) << 32;
+}
+
+// number of bytes the transforms in `flags` put at the start of a payload
+static size_t transformHeaderSize(uint8_t flags)
+{
+	return (flags & BLOCK_BWT) ? 4 : 0;
+}
+
+// writes a FRAME_HEADERSIZE-byte file header to `out`
+void writeFrameHeader(uint8_t* out, uint8_t flags)
+{
+	std::memcpy(out, FRAME_MAGIC, 4);
+	out[4] = FRAME_VERSION;
+	out[5] = flags;
+}
+
+// returns true if the FRAME_HEADERSIZE bytes at `in` are a file header of a
+// supported version
+bool readFrameHeader(const uint8_t* in)
+{
+	return std::memcmp(in, FRAME_MAGIC, 4) == 0 and in[4] == FRAME_VERSION
+	       and (in[5] & ~FRAME_INDEXED) == 0;
+}
+
+// writes the BLOCK_HEADERSIZE-byte form of `h` to `out`
+void writeBlockHeader(uint8_t* out, const blockheader_t& h)
+{
+	out[0] = h.type;
+	out[1] = h.flags;
+	out[2] = h.table;
+	putU32(out + 3, h.rawsize);
+	putU32(out + 7, h.packsize);
+}
+
+// largest payload a block of `rawsize` bytes coded as `flags` says can have,
+// whatever code it was written with: the decoder takes codes up to
+// DECODE_MAXBITS long, and a context model has a code per group
+static size_t maxPackSize(size_t rawsize, uint8_t flags)
+{
+	size_t model = (flags & BLOCK_CONTEXT) ? CONTEXT_MAXHEADER : 0;
+
+	return maxBlockSize(rawsize, DECODE_MAXBITS, flags) - BLOCK_HEADERSIZE
+	       + model;
+}
+
+// reads the BLOCK_HEADERSIZE bytes at `in` into `h`, returns false if the
+// header is invalid
+bool readBlockHeader(const uint8_t* in, blockheader_t& h)
+{
+	h.type = in[0];
+	h.flags = in[1];
+	h.table = in[2];
+	h.rawsize = getU32(in + 3);
+	h.packsize = getU32(in + 7);
+
+	/* raw blocks are just their bytes */
+	if (h.type == BLOCK_RAW)
+		return h.flags == 0 and h.table == TABLE_INLINE
+		       and h.rawsize <= BLOCK_MAXSIZE and h.packsize == h.rawsize;
+
+	/* anything coded is no bigger than its longest codes make it, so a */
+	/* larger payload is corrupt, and mustn't be read into memory */
+	if (h.rawsize > BLOCK_MAXSIZE
+	    or h.packsize > maxPackSize(h.rawsize, h.flags))
+		return false;
+
+	/* transforms go with any layout of bytes, and may need room of their */
+	/* own at the start of the payload */
+	uint8_t layout = h.flags & ~BLOCK_TRANSFORMS;
+	if ((h.flags & BLOCK_TRANSFORMS)
+	    and (h.type != BLOCK_HUFFMAN or (h.flags & BLOCK_WIDE)
+	         or h.packsize < transformHeaderSize(h.flags)))
+		return false;
+
+	/* context-coded, wide and run-coded blocks always carry their own */
+	/* code, and have layouts of their own */
+	if (h.type == BLOCK_HUFFMAN
+	    and (layout & (BLOCK_CONTEXT | BLOCK_WIDE | BLOCK_RUNS)))
+		return (layout == BLOCK_CONTEXT or layout == BLOCK_WIDE
+		        or layout == BLOCK_RUNS)
+		       and h.table == TABLE_INLINE;
+
+	return h.type <= BLOCK_HUFFMAN and (layout & ~BLOCK_INTERLEAVED) == 0
+	       and (h.table == TABLE_INLINE or h.table == TABLE_PREVIOUS
+	            or h.table >= TABLE_USERMIN
+	            or getStaticTable(h.table) != nullptr);
+}
+
+// largest number of bytes (header included) that encodeBlock can produce for
+// a block of `rawsize` bytes with codes up to `maxbits` long, coded as
+// `flags` says
+size_t maxBlockSize(size_t rawsize, int maxbits, uint8_t flags)
+{
+	/* every symbol's length, then two bytes per code and a leftover byte, */
+	/* unless that's more than the raw block it would give way to */
+	if (flags & BLOCK_WIDE)
+	{
+		maxbits = std::max(maxbits, BLOCK_WIDEMINBITS);
+		return std::max(BLOCK_HEADERSIZE + BLOCK_WIDESYMBOLS
+		                + (rawsize / 2 * maxbits + 7) / 8 + 1 + 8,
+		                BLOCK_HEADERSIZE + rawsize);
+	}
+
+	/* interleaved streams each round up to a byte, and need their sizes. */
+	/* runs have at most a symbol per byte, and the lengths of the two */
+	/* extra symbols fit in the room the sizes take. transforms keep the */
+	/* block's size, but may need a header */
+	return BLOCK_HEADERSIZE + CANON_MAXHEADER + (rawsize * maxbits + 7) / 8
+	       + (INTERLEAVE_STREAMS - 1) * 5 + 8
+	       + transformHeaderSize(BLOCK_TRANSFORMS);
+}
+
+// adds a block with header `h` to `stats`, along with the code words of the
+// `n` code lengths at `lengths` if they're the block's own code
+static void countBlock(metrics* stats, const blockheader_t& h,
+                       const uint8_t* lengths = nullptr, size_t n = 256)
+{
+	if (stats == nullptr)
+		return;
+
+	stats->add(COUNT_BLOCKS, 1);
+	stats->add(COUNT_PAYLOAD, h.packsize);
+	if (h.type == BLOCK_RAW)
+		stats->add(COUNT_BLOCKS_RAW, 1);
+	else if (h.table == TABLE_INLINE)
+	{
+		if (h.flags & BLOCK_CONTEXT)
+			stats->add(COUNT_BLOCKS_CONTEXT, 1);
+		else if (h.flags & BLOCK_RUNS)
+			stats->add(COUNT_BLOCKS_RUNS, 1);
+		else
+			stats->add(COUNT_BLOCKS_NEW, 1);
+		for (size_t i = 0; i < n and lengths != nullptr; i++)
+			stats->add(COUNT_CODEWORDS, lengths[i] != 0);
+	}
+	else
+		stats->add(COUNT_BLOCKS_REUSED, 1);
+	if (h.type == BLOCK_HUFFMAN and (h.flags & BLOCK_TRANSFORMS))
+		stats->add(COUNT_TRANSFORMED, 1);
+}
+
+// puts the `n` bytes at `in` through `transforms` into `plan.transformed`,
+// returns the bytes to plan the block from
+const uint8_t* planTransforms(const uint8_t* in, size_t n, uint8_t transforms,
+                              blockplan_t& plan, blockscratch_t& scratch,
+                              metrics* stats)
+{
+	plan.transforms = transforms & BLOCK_TRANSFORMS;
+	plan.bwtindex = 0;
+	if (plan.transforms == 0)
+		return in;
+
+	phasetimer transforming(stats, PHASE_TRANSFORM);
+	plan.transformed.resize(n);
+	uint8_t* out = plan.transformed.data();
+	const uint8_t* from = in;
+
+	/* the sort needs its input to stay put while it writes its output, so */
+	/* delta coding ahead of it goes to one side */
+	if (transforms & BLOCK_DELTA)
+	{
+		uint8_t* to = out;
+		if (transforms & BLOCK_BWT)
+		{
+			scratch.transformed.resize(n);
+			to = scratch.transformed.data();
+		}
+		deltaEncode(from, n, to);
+		from = to;
+	}
+	if (transforms & BLOCK_BWT)
+	{
+		plan.bwtindex = bwtEncode(from, n, out, scratch.transformwork);
+		from = out;
+	}
+	if (transforms & BLOCK_MTF)
+		mtfEncode(from, n, out);
+
+	return out;
+}
+
+// fills `plan` with the byte counts of the `n` bytes at `in` and the best
+// code for them of up to `maxbits` bits. returns false if there isn't one
+bool planBlock(const uint8_t* in, size_t n, int maxbits, blockplan_t& plan,
+               blockscratch_t& scratch, metrics* stats)
+{
+	phasetimer counting(stats, PHASE_HISTOGRAM);
+	std::memset(plan.hist, 0, sizeof(plan.hist));
+	countBytes(plan.hist, in, n);
+	counting.stop();
+
+	phasetimer building(stats, PHASE_TREE);
+	plan.type = BLOCK_HUFFMAN;
+	plan.table = TABLE_INLINE;
+	plan.context = false;
+	plan.contextsize = 0;
+	plan.runs = false;
+	plan.runsize = 0;
+	return getLimitedLengths(plan.lengths, plan.hist, 256, maxbits,
+	                         scratch.lengths);
+}
+
+// fills `plan.model` with a context model of up to `maxbits`-bit codes for
+// the `n` bytes at `in`, and `plan.contextsize` with the payload it makes.
+// returns false if there isn't one
+bool planContext(const uint8_t* in, size_t n, int maxbits, blockplan_t& plan,
+                 blockscratch_t& scratch, metrics* stats)
+{
+	uint8_t packed[CONTEXT_MAXHEADER];
+
+	phasetimer counting(stats, PHASE_HISTOGRAM);
+	scratch.pairs.assign(256 * 256, 0);
+	countPairs(scratch.pairs.data(), in, n);
+	counting.stop();
+
+	/* a group per CONTEXT_GROUPBYTES bytes, so small blocks get few */
+	phasetimer building(stats, PHASE_TREE);
+	size_t groups = std::max(n / CONTEXT_GROUPBYTES, (size_t)2);
+	plan.contextsize = 0;
+	if (!buildContextModel(plan.model, scratch.pairs.data(), groups, maxbits,
+	                       scratch.lengths))
+		return false;
+
+	size_t coded = contextCodedSize(plan.model, scratch.pairs.data());
+	if (coded != 0)
+		plan.contextsize = packContextModel(plan.model, packed) + coded;
+	return coded != 0;
+}
+
+// fills `plan.runlengths` with a code of up to `maxbits` bits for the
+// run-length form of the `n` bytes at `in`, and `plan.runsize` with the
+// payload it makes. returns false if there isn't one
+bool planRuns(const uint8_t* in, size_t n, int maxbits, blockplan_t& plan,
+              blockscratch_t& scratch, metrics* stats)
+{
+	uint8_t packed[RUN_SYMBOLS];
+	uint64_t bits = 0;
+
+	phasetimer counting(stats, PHASE_HISTOGRAM);
+	std::memset(plan.runhist, 0, sizeof(plan.runhist));
+	countRuns(plan.runhist, in, n);
+	counting.stop();
+
+	phasetimer building(stats, PHASE_TREE);
+	plan.runsize = 0;
+	if (!getLimitedLengths(plan.runlengths, plan.runhist, RUN_SYMBOLS, maxbits,
+	                       scratch.lengths))
+		return false;
+
+	for (int s = 0; s < RUN_SYMBOLS; s++)
+		bits += (uint64_t)plan.runhist[s] * plan.runlengths[s];
+	plan.runsize = packLengths(plan.runlengths, RUN_SYMBOLS, packed)
+	               + (bits + 7) / 8;
+	return true;
+}
+
+// fills `plan` so that the block is coded with `table`
+void planTable(blockplan_t& plan, const codetable_t& table)
+{
+	plan.type = BLOCK_HUFFMAN;
+	plan.table = table.id;
+	plan.context = false;
+	plan.contextsize = 0;
+	plan.runs = false;
+	plan.runsize = 0;
+	plan.transforms = 0;
+	std::memcpy(plan.lengths, table.lengths, 256);
+}
+
+// number of payload bytes the codes for `hist` take up with `lengths`, or 0
+// if some byte in `hist` has no code
+static size_t codedSize(const uint32_t hist[256], const uint8_t lengths[256],
+                        uint8_t flags)
+{
+	uint64_t bits = 0;
+
+	for (int i = 0; i < 256; i++)
+	{
+		if (hist[i] and lengths[i] == 0)
+			return 0;
+		bits += (uint64_t)hist[i] * lengths[i];
+	}
+
+	/* interleaved streams need their sizes, and each pads out a byte */
+	if (flags & BLOCK_INTERLEAVED)
+		return (bits + 7) / 8 + (INTERLEAVE_STREAMS - 1) * 5;
+	return (bits + 7) / 8;
+}
+
+// changes `plan` to whichever of its own table, the table in `history`, its
+// context model, its runs or a raw copy stores the `n` bytes in the fewest
+// bytes, updating `history` if the block keeps its own order-0 table
+void chooseBlock(blockplan_t& plan, size_t n, uint8_t flags,
+                 blockhistory_t& history)
+{
+	uint8_t packed[CANON_MAXHEADER];
+	size_t fresh = packLengths(plan.lengths, 256, packed)
+	               + codedSize(plan.hist, plan.lengths, flags);
+	size_t reused = history.valid
+	                ? codedSize(plan.hist, history.lengths, flags) : 0;
+
+	/* an old table can only be reused if it has a code for every byte */
+	if (reused != 0 and reused <= fresh)
+	{
+		plan.table = TABLE_PREVIOUS;
+		std::memcpy(plan.lengths, history.lengths, 256);
+		fresh = reused;
+	}
+
+	/* a context model stores a code per group, so has to save more than */
+	/* those cost */
+	if (plan.contextsize != 0 and plan.contextsize < fresh)
+	{
+		plan.context = true;
+		plan.table = TABLE_INLINE;
+		fresh = plan.contextsize;
+	}
+
+	/* so do runs, which only pay off when there are plenty of them */
+	if (plan.runsize != 0 and plan.runsize < fresh)
+	{
+		plan.runs = true;
+		plan.context = false;
+		plan.table = TABLE_INLINE;
+		fresh = plan.runsize;
+	}
+
+	/* data which doesn't compress (or was compressed already) is copied, */
+	/* without any transforms or what they store */
+	if (n <= fresh + transformHeaderSize(plan.transforms))
+	{
+		plan.type = BLOCK_RAW;
+		plan.table = TABLE_INLINE;
+		plan.context = false;
+		plan.runs = false;
+	}
+	else if (plan.table == TABLE_INLINE and not plan.context and not plan.runs)
+	{
+		history.valid = true;
+		std::memcpy(history.lengths, plan.lengths, 256);
+	}
+}
+
+// writes what the transforms of `plan` store at the start of the payload of
+// the block at `out`, returns where the rest of the payload goes
+static uint8_t* startPayload(uint8_t* out, const blockplan_t& plan)
+{
+	uint8_t* pos = out + BLOCK_HEADERSIZE;
+
+	if (plan.transforms & BLOCK_BWT)
+	{
+		putU32(pos, plan.bwtindex);
+		pos += 4;
+	}
+	return pos;
+}
+
+// writes a BLOCK_CONTEXT block for the `n` bytes at `in` to `out`, coded
+// with `plan.model`, returns the number of bytes written
+static size_t writeContextBlock(const uint8_t* in, size_t n, uint8_t* out,
+                                const blockplan_t& plan, metrics* stats)
+{
+	huffcode_t map[256];
+	streamcode_t codes[CONTEXT_MAXGROUPS][256];
+	uint8_t* pos = startPayload(out, plan);
+	const contextmodel_t& model = plan.model;
+
+	phasetimer building(stats, PHASE_TREE);
+	for (size_t g = 0; g < model.ngroups; g++)
+	{
+		getCanonicalMap(map, model.lengths[g], 256);
+		getStreamCodes(codes[g], map, 256);
+	}
+	building.stop();
+
+	/* payload is the model, then the codes */
+	phasetimer encoding(stats, PHASE_ENCODE);
+	pos += packContextModel(model, pos);
+	pos += encodeContextCodes(codes, model.groups, in, n, pos);
+
+	blockheader_t h = {BLOCK_HUFFMAN, (uint8_t)(BLOCK_CONTEXT | plan.transforms),
+	                   TABLE_INLINE, (uint32_t)n,
+	                   (uint32_t)(pos - out - BLOCK_HEADERSIZE)};
+	writeBlockHeader(out, h);
+	countBlock(stats, h, model.lengths[0], model.ngroups * 256);
+
+	return pos - out;
+}
+
+// writes a BLOCK_RUNS block for the `n` bytes at `in` to `out`, coded with
+// `plan.runlengths`, returns the number of bytes written
+static size_t writeRunsBlock(const uint8_t* in, size_t n, uint8_t* out,
+                             const blockplan_t& plan, metrics* stats)
+{
+	huffcode_t map[RUN_SYMBOLS];
+	streamcode_t codes[RUN_SYMBOLS];
+	uint8_t* pos = startPayload(out, plan);
+
+	phasetimer building(stats, PHASE_TREE);
+	getCanonicalMap(map, plan.runlengths, RUN_SYMBOLS);
+	getStreamCodes(codes, map, RUN_SYMBOLS);
+	building.stop();
+
+	/* payload is the lengths, then the codes */
+	phasetimer encoding(stats, PHASE_ENCODE);
+	pos += packLengths(plan.runlengths, RUN_SYMBOLS, pos);
+	pos += encodeRuns(codes, in, n, pos);
+
+	blockheader_t h = {BLOCK_HUFFMAN, (uint8_t)(BLOCK_RUNS | plan.transforms),
+	                   TABLE_INLINE, (uint32_t)n,
+	                   (uint32_t)(pos - out - BLOCK_HEADERSIZE)};
+	writeBlockHeader(out, h);
+	countBlock(stats, h, plan.runlengths, RUN_SYMBOLS);
+
+	return pos - out;
+}
+
+// writes a block header and payload for the `n` bytes at `in` (or their
+// transformed form) to `out`, as `plan` says, returns the number of bytes
+// written
+size_t writeBlock(const uint8_t* in, size_t n, uint8_t* out, uint8_t flags,
+                  const blockplan_t& plan, metrics* stats)
+{
+	huffcode_t map[256];
+	streamcode_t codes[256];
+	uint8_t* pos = out + BLOCK_HEADERSIZE;
+
+	if (plan.type == BLOCK_RAW)
+	{
+		phasetimer copying(stats, PHASE_ENCODE);
+		blockheader_t h = {BLOCK_RAW, 0, TABLE_INLINE, (uint32_t)n,
+		                   (uint32_t)n};
+		writeBlockHeader(out, h);
+		std::memcpy(pos, in, n);
+		countBlock(stats, h);
+		return BLOCK_HEADERSIZE + n;
+	}
+
+	/* anything coded is coded from the block's bytes after its transforms */
+	if (plan.transforms)
+	{
+		in = plan.transformed.data();
+		pos = startPayload(out, plan);
+		flags |= plan.transforms;
+	}
+	if (plan.context)
+		return writeContextBlock(in, n, out, plan, stats);
+	if (plan.runs)
+		return writeRunsBlock(in, n, out, plan, stats);
+
+	phasetimer building(stats, PHASE_TREE);
+	getCanonicalMap(map, plan.lengths, 256);
+	getStreamCodes(codes, map, 256);
+	building.stop();
+
+	phasetimer encoding(stats, PHASE_ENCODE);
+
+	/* payload is the packed lengths (unless the decoder already has them), */
+	/* then the codes */
+	if (plan.table == TABLE_INLINE)
+		pos += packLengths(plan.lengths, 256, pos);
+
+	if (flags & BLOCK_INTERLEAVED)
+	{
+		/* the streams go one after the other, since each one's writer */
+		/* stores whole words past its end, then the sizes go in front */
+		uint8_t* sizes = pos;
+		pos += (INTERLEAVE_STREAMS - 1) * 4;
+		for (size_t s = 0; s < INTERLEAVE_STREAMS; s++)
+		{
+			size_t count = (n + INTERLEAVE_STREAMS - 1 - s) / INTERLEAVE_STREAMS;
+			size_t used = encodeCodes(codes, in + s, count, pos,
+			                          INTERLEAVE_STREAMS);
+			if (s < INTERLEAVE_STREAMS - 1)
+				putU32(sizes + s * 4, used);
+			pos += used;
+		}
+	}
+	else
+		pos += encodeCodes(codes, in, n, pos);
+
+	blockheader_t h = {BLOCK_HUFFMAN, flags, plan.table, (uint32_t)n,
+	                   (uint32_t)(pos - out - BLOCK_HEADERSIZE)};
+	writeBlockHeader(out, h);
+	countBlock(stats, h, plan.lengths);
+
+	return pos - out;
+}
+
+// builds a length-limited canonical code for the `n` bytes at `in`, and
+// writes a block header, the code lengths and the codes to `out` (or the
+// bytes themselves, if that's smaller). returns the number of bytes written,
+// or 0 if `maxbits` is too short for the block
+size_t encodeBlock(const uint8_t* in, size_t n, int maxbits, uint8_t* out,
+                   uint8_t flags)
+{
+	blockscratch_t scratch;
+
+	return encodeBlock(in, n, maxbits, out, flags, scratch);
+}
+
+// same as above, working in `scratch`, and coding with `table` if given
+size_t encodeBlock(const uint8_t* in, size_t n, int maxbits, uint8_t* out,
+                   uint8_t flags, blockscratch_t& scratch,
+                   const codetable_t* table)
+{
+	blockplan_t plan;
+
+	/* a static table is used as it is, without counting anything first */
+	if (table != nullptr)
+		planTable(plan, *table);
+	else
+	{
+		blockhistory_t history;
+
+		if (!planBlock(in, n, maxbits, plan, scratch))
+			return 0;
+		chooseBlock(plan, n, flags, history);
+	}
+
+	return writeBlock(in, n, out, flags, plan);
+}
+
+// writes a BLOCK_WIDE block for the `n` bytes at `in` to `out`, coded as
+// 16-bit symbols with codes of up to `maxbits` bits (or BLOCK_WIDEMINBITS),
+// or a raw block if that's smaller. returns the number of bytes written
+size_t encodeWideBlock(const uint8_t* in, size_t n, int maxbits, uint8_t* out,
+                       blockscratch_t& scratch, metrics* stats)
+{
+	std::vector<uint32_t>& hist = scratch.pairs;
+	std::vector<uint8_t>& lengths = scratch.widelengths;
+	size_t symbols = n / 2;
+	uint8_t* pos = out + BLOCK_HEADERSIZE;
+	blockplan_t raw;
+
+	/* each packed byte holds at most 128 lengths, so a block no bigger than */
+	/* the lengths can't get any smaller, and isn't worth counting */
+	raw.type = BLOCK_RAW;
+	if (n <= BLOCK_WIDESYMBOLS / 128)
+		return writeBlock(in, n, out, 0, raw, stats);
+
+	phasetimer counting(stats, PHASE_HISTOGRAM);
+	hist.assign(BLOCK_WIDESYMBOLS, 0);
+	countSymbols<uint16_t>(hist.data(), in, symbols);
+	counting.stop();
+
+	phasetimer building(stats, PHASE_TREE);
+	lengths.resize(BLOCK_WIDESYMBOLS);
+	getLimitedLengths(lengths.data(), hist.data(), BLOCK_WIDESYMBOLS,
+	                  std::max(maxbits, BLOCK_WIDEMINBITS), scratch.lengths);
+
+	/* the lengths go straight into the payload, so their size is known */
+	/* before deciding whether to code the block at all */
+	size_t packed = packLengths(lengths.data(), BLOCK_WIDESYMBOLS, pos);
+	uint64_t bits = 0;
+	for (size_t s = 0; s < BLOCK_WIDESYMBOLS; s++)
+		bits += (uint64_t)hist[s] * lengths[s];
+	if (packed + (bits + 7) / 8 + n % 2 >= n)
+	{
+		building.stop();
+		return writeBlock(in, n, out, 0, raw, stats);
+	}
+
+	scratch.widemap.resize(BLOCK_WIDESYMBOLS);
+	scratch.widecodes.resize(BLOCK_WIDESYMBOLS);
+	getCanonicalMap(scratch.widemap.data(), lengths.data(), BLOCK_WIDESYMBOLS);
+	getStreamCodes(scratch.widecodes.data(), scratch.widemap.data(),
+	               BLOCK_WIDESYMBOLS);
+	building.stop();
+
+	/* payload is the lengths, then the codes, then any odd byte out */
+	phasetimer encoding(stats, PHASE_ENCODE);
+	pos += packed;
+	pos += encodeSymbols<uint16_t>(scratch.widecodes.data(), in, symbols, pos);
+	if (n % 2)
+		*pos++ = in[n - 1];
+
+	blockheader_t h = {BLOCK_HUFFMAN, BLOCK_WIDE, TABLE_INLINE, (uint32_t)n,
+	                   (uint32_t)(pos - out - BLOCK_HEADERSIZE)};
+	writeBlockHeader(out, h);
+	countBlock(stats, h, lengths.data(), BLOCK_WIDESYMBOLS);
+
+	return pos - out;
+}
+
+// fills `lengths` from the payload at `in` of a block with its own code,
+// returns the number of bytes they (and any transform header) take up, or 0
+// on failure
+size_t readBlockLengths(const blockheader_t& h, const uint8_t* in,
+                        uint8_t lengths[256])
+{
+	size_t skip = transformHeaderSize(h.flags);
+
+	if (not storesTable(h) or h.packsize < skip)
+		return 0;
+
+	size_t used = unpackLengths(in + skip, h.packsize - skip, lengths, 256);
+	return used ? skip + used : 0;
+}
+
+// returns true if the block with header `h` stores a code which a later
+// TABLE_PREVIOUS block would reuse
+bool storesTable(const blockheader_t& h)
+{
+	return h.type == BLOCK_HUFFMAN and h.table == TABLE_INLINE
+	       and not (h.flags & (BLOCK_CONTEXT | BLOCK_WIDE | BLOCK_RUNS));
+}
+
+// decodes the `h.packsize` bytes of payload at `in` (for the block with
+// header `h`) into the `h.rawsize` bytes at `out`. returns false if the
+// payload is corrupt
+bool decodeBlock(const blockheader_t& h, const uint8_t* in, uint8_t* out)
+{
+	blockscratch_t scratch;
+
+	return decodeBlock(h, in, out, scratch);
+}
+
+// decodes the payload at `in` of the BLOCK_CONTEXT block with header `h`
+// into `out`, with the decode tables of each group built in `scratch`
+static bool decodeContextBlock(const blockheader_t& h, const uint8_t* in,
+                               uint8_t* out, blockscratch_t& scratch,
+                               metrics* stats)
+{
+	contextmodel_t model;
+	huffcode_t map[256];
+
+	phasetimer building(stats, PHASE_TREE);
+	size_t used = unpackContextModel(in, h.packsize, model);
+	if (used == 0)
+		return false;
+
+	/* no code is long enough to need the tree once its table is built, */
+	/* so every group's tree can take its turn in the arena */
+	for (size_t g = 0; g < model.ngroups; g++)
+	{
+		getCanonicalMap(map, model.lengths[g], 256);
+		scratch.arena.reset();
+		node* tree = getTreeFromMap(map, 256, &scratch.arena);
+		if (tree == nullptr or not buildDecodeTable(scratch.grouptables[g],
+		                                            tree))
+			return false;
+	}
+	if (not buildContextTable(scratch.contexttable, scratch.grouptables,
+	                          model.ngroups, model.groups))
+		return false;
+	building.stop();
+
+	phasetimer decoding(stats, PHASE_DECODE);
+	if (not decodeContextCodes(scratch.contexttable, in + used,
+	                           h.packsize - used, out, h.rawsize))
+		return false;
+
+	countBlock(stats, h, model.lengths[0], model.ngroups * 256);
+	return true;
+}
+
+// decodes the payload at `in` of the BLOCK_WIDE block with header `h` into
+// `out`, with its decode tables built in `scratch`
+static bool decodeWideBlock(const blockheader_t& h, const uint8_t* in,
+                            uint8_t* out, blockscratch_t& scratch,
+                            metrics* stats)
+{
+	std::vector<uint8_t>& lengths = scratch.widelengths;
+	std::vector<huffcode_t>& map = scratch.widemap;
+	size_t symbols = h.rawsize / 2;
+
+	phasetimer building(stats, PHASE_TREE);
+	lengths.resize(BLOCK_WIDESYMBOLS);
+	map.resize(BLOCK_WIDESYMBOLS);
+	size_t used = unpackLengths(in, h.packsize, lengths.data(),
+	                            BLOCK_WIDESYMBOLS);
+	if (used == 0 or h.packsize - used < h.rawsize % 2)
+		return false;
+	getCanonicalMap(map.data(), lengths.data(), BLOCK_WIDESYMBOLS);
+
+	/* the tree is needed until decoding is done (for any codes too long */
+	/* for the tables), and the arena grows once to hold a whole alphabet's */
+	scratch.arena.reserve(ARENA_WIDENODES);
+	scratch.arena.reset();
+	node* tree = getTreeFromMap(map.data(), BLOCK_WIDESYMBOLS, &scratch.arena);
+	bool ok = tree != nullptr and buildDecodeTable(scratch.table, tree);
+	building.stop();
+
+	phasetimer decoding(stats, PHASE_DECODE);
+	size_t left = h.packsize - used - h.rawsize % 2;
+	ok = ok and decodeSymbols<uint16_t>(scratch.table, in + used, left, out,
+	                                    symbols);
+	if (ok and h.rawsize % 2)
+		out[h.rawsize - 1] = in[h.packsize - 1];
+
+	if (ok)
+		countBlock(stats, h, lengths.data(), BLOCK_WIDESYMBOLS);
+	return ok;
+}
+
+// decodes the payload at `in` of the BLOCK_RUNS block with header `h` into
+// `out`, with its code tree and decode tables built in `scratch`
+static bool decodeRunsBlock(const blockheader_t& h, const uint8_t* in,
+                            uint8_t* out, blockscratch_t& scratch,
+                            metrics* stats)
+{
+	uint8_t lengths[RUN_SYMBOLS];
+	huffcode_t map[RUN_SYMBOLS];
+
+	phasetimer building(stats, PHASE_TREE);
+	size_t used = unpackLengths(in, h.packsize, lengths, RUN_SYMBOLS);
+	if (used == 0)
+		return false;
+	getCanonicalMap(map, lengths, RUN_SYMBOLS);
+
+	scratch.arena.reset();
+	node* tree = getTreeFromMap(map, RUN_SYMBOLS, &scratch.arena);
+	if (tree == nullptr or not buildDecodeTable(scratch.table, tree))
+		return false;
+	building.stop();
+
+	phasetimer decoding(stats, PHASE_DECODE);
+	if (not decodeRuns(scratch.table, in + used, h.packsize - used, out,
+	                   h.rawsize))
+		return false;
+
+	countBlock(stats, h, lengths, RUN_SYMBOLS);
+	return true;
+}
+
+// decodes the payload at `in` of the block with header `h`, whose bytes went
+// through transforms, into `out`: decodes what was coded (into `out`, or to
+// one side if the sort has to be undone), then undoes the transforms in the
+// opposite order
+static bool decodeTransformedBlock(const blockheader_t& h, const uint8_t* in,
+                                   uint8_t* out, blockscratch_t& scratch,
+                                   const codetable_t* user,
+                                   const uint8_t* previous, metrics* stats)
+{
+	size_t skip = transformHeaderSize(h.flags);
+	blockheader_t coded = h;
+	uint8_t* to = out;
+
+	if (h.packsize < skip)
+		return false;
+	coded.flags &= ~BLOCK_TRANSFORMS;
+	coded.packsize -= skip;
+	if (h.flags & BLOCK_BWT)
+	{
+		scratch.transformed.resize(h.rawsize);
+		to = scratch.transformed.data();
+	}
+	if (not decodeBlock(coded, in + skip, to, scratch, user, previous, stats))
+		return false;
+
+	phasetimer transforming(stats, PHASE_TRANSFORM);
+	if (h.flags & BLOCK_MTF)
+		mtfDecode(to, h.rawsize);
+	if ((h.flags & BLOCK_BWT)
+	    and not bwtDecode(to, h.rawsize, getU32(in), out,
+	                      scratch.transformwork))
+		return false;
+	if (h.flags & BLOCK_DELTA)
+		deltaDecode(out, h.rawsize);
+
+	if (stats != nullptr)
+	{
+		stats->add(COUNT_PAYLOAD, skip);
+		stats->add(COUNT_TRANSFORMED, 1);
+	}
+	return true;
+}
+
+// same as above, with the code tree and decode tables built in `scratch`,
+// `user` available to blocks coded with a loaded table, and `previous` to
+// blocks which reuse an earlier block's code
+bool decodeBlock(const blockheader_t& h, const uint8_t* in, uint8_t* out,
+                 blockscratch_t& scratch, const codetable_t* user,
+                 const uint8_t* previous, metrics* stats)
+{
+	decodetable_t& table = scratch.table;
+	uint8_t lengths[256];
+	huffcode_t map[256];
+	size_t used = 0;
+	bool ok;
+
+	if (h.type == BLOCK_RAW and h.packsize == h.rawsize)
+	{
+		phasetimer copying(stats, PHASE_DECODE);
+		std::memcpy(out, in, h.rawsize);
+		countBlock(stats, h);
+		return true;
+	}
+	if (h.type != BLOCK_HUFFMAN)
+		return false;
+	if (h.flags & BLOCK_TRANSFORMS)
+		return decodeTransformedBlock(h, in, out, scratch, user, previous,
+		                              stats);
+	if (h.flags & BLOCK_CONTEXT)
+		return decodeContextBlock(h, in, out, scratch, stats);
+	if (h.flags & BLOCK_WIDE)
+		return decodeWideBlock(h, in, out, scratch, stats);
+	if (h.flags & BLOCK_RUNS)
+		return decodeRunsBlock(h, in, out, scratch, stats);
+
+	phasetimer building(stats, PHASE_TREE);
+
+	if (h.table == TABLE_INLINE)
+	{
+		used = readBlockLengths(h, in, lengths);
+		if (used == 0)
+			return false;
+		getCanonicalMap(map, lengths, 256);
+	}
+	else if (h.table == TABLE_PREVIOUS)
+	{
+		if (previous == nullptr)
+			return false;
+		getCanonicalMap(map, previous, 256);
+	}
+	else
+	{
+		const codetable_t* t = findTable(h.table, user);
+		if (t == nullptr)
+			return false;
+		getCanonicalMap(map, t->lengths, 256);
+	}
+
+	/* the tree is only needed until the tables are built from it (and for */
+	/* any very long codes), so it can live in the arena */
+	scratch.arena.reset();
+	node* tree = getTreeFromMap(map, 256, &scratch.arena);
+
+	if (tree == nullptr or not buildDecodeTable(table, tree))
+		return false;
+	building.stop();
+
+	phasetimer decoding(stats, PHASE_DECODE);
+	if (h.flags & BLOCK_INTERLEAVED)
+	{
+		const uint8_t* streams[INTERLEAVE_STREAMS];
+		size_t streamlen[INTERLEAVE_STREAMS];
+		size_t left = h.packsize - used;
+		const uint8_t* pos = in + used;
+
+		/* find where each stream starts from the sizes of those before it */
+		ok = left >= (INTERLEAVE_STREAMS - 1) * 4;
+		if (ok)
+		{
+			const uint8_t* sizes = pos;
+			pos += (INTERLEAVE_STREAMS - 1) * 4;
+			left -= (INTERLEAVE_STREAMS - 1) * 4;
+			for (size_t s = 0; s < INTERLEAVE_STREAMS and ok; s++)
+			{
+				streamlen[s] = (s < INTERLEAVE_STREAMS - 1)
+				               ? getU32(sizes + s * 4) : left;
+				ok = streamlen[s] <= left;
+				streams[s] = pos;
+				pos += streamlen[s];
+				left -= ok ? streamlen[s] : 0;
+			}
+		}
+
+		ok = ok and decodeCodesInterleaved(table, streams, streamlen, out,
+		                                   h.rawsize);
+	}
+	else
+		ok = decodeCodes(table, in + used, h.packsize - used, out, h.rawsize);
+
+	if (ok)
+		countBlock(stats, h, lengths);
+	return ok;
+}
+
+// appends the entry for a block (or the end block) to `index`
+void addIndexEntry(std::vector<indexentry_t>& index, uint64_t offset,
+                   uint64_t rawoffset, uint8_t type, uint8_t table,
+                   uint8_t flags)
+{
+	/* a block reusing a table reuses the one the block before it would */
+	uint32_t source = index.empty() ? INDEX_NOTABLE : index.back().table;
+
+	if (storesTable(blockheader_t{type, flags, table, 0, 0}))
+		source = index.size();
+	index.push_back(indexentry_t{offset, rawoffset, source});
+}
+
+// number of bytes writeIndex produces for `entries` entries
+size_t indexSize(size_t entries)
+{
+	return entries * INDEX_ENTRYSIZE + INDEX_TRAILERSIZE;
+}
+
+// writes the entries of `index` and then the trailer to `out`, returns the
+// number of bytes written
+size_t writeIndex(const std::vector<indexentry_t>& index, uint8_t* out)
+{
+	uint8_t* pos = out;
+
+	for (const indexentry_t& e : index)
+	{
+		putU64(pos, e.offset);
+		putU64(pos + 8, e.rawoffset);
+		putU32(pos + 16, e.table);
+		pos += INDEX_ENTRYSIZE;
+	}
+
+	putU64(pos, index.size());
+	std::memcpy(pos + 8, INDEX_MAGIC, 4);
+
+	return pos + INDEX_TRAILERSIZE - out;
+}
+
+// fills `index` from the index at the end of the `n`-byte framed file at
+// `in`, returns false if it's malformed
+static bool readStoredIndex(const uint8_t* in, size_t n,
+                            std::vector<indexentry_t>& index)
+{
+	if (n < FRAME_HEADERSIZE + BLOCK_HEADERSIZE + INDEX_TRAILERSIZE)
+		return false;
+
+	const uint8_t* trailer = in + n - INDEX_TRAILERSIZE;
+	uint64_t count = getU64(trailer);
+	size_t room = trailer - in - FRAME_HEADERSIZE - BLOCK_HEADERSIZE;
+
+	if (std::memcmp(trailer + 8, INDEX_MAGIC, 4) != 0 or count == 0
+	    or count > room / INDEX_ENTRYSIZE)
+		return false;
+
+	/* the end block comes just before the index */
+	const uint8_t* pos = trailer - count * INDEX_ENTRYSIZE;
+	uint64_t end = pos - in - BLOCK_HEADERSIZE;
+	blockheader_t h;
+
+	index.resize(count);
+	for (size_t i = 0; i < count; i++, pos += INDEX_ENTRYSIZE)
+	{
+		indexentry_t& e = index[i];
+		e.offset = getU64(pos);
+		e.rawoffset = getU64(pos + 8);
+		e.table = getU32(pos + 16);
+
+		/* blocks must follow one another, with room for their headers, */
+		/* and only reuse the tables of blocks before them */
+		if (i == 0 ? (e.offset != FRAME_HEADERSIZE or e.rawoffset != 0)
+		           : (e.offset < index[i - 1].offset + BLOCK_HEADERSIZE
+		              or e.rawoffset < index[i - 1].rawoffset
+		              or e.rawoffset - index[i - 1].rawoffset > BLOCK_MAXSIZE))
+			return false;
+		if (e.offset > end or (e.table != INDEX_NOTABLE and e.table > i))
+			return false;
+	}
+
+	return index.back().offset == end and readBlockHeader(in + end, h)
+	       and h.type == BLOCK_END;
+}
+
+// fills `index` with an entry for every block of the `n`-byte framed file at
+// `in`, and the end block, returns false if the file is malformed
+bool readIndex(const uint8_t* in, size_t n, std::vector<indexentry_t>& index)
+{
+	size_t pos = FRAME_HEADERSIZE;
+	uint64_t rawoffset = 0;
+	blockheader_t h;
+
+	index.clear();
+	if (n < FRAME_HEADERSIZE or not readFrameHeader(in))
+		return false;
+	if (in[5] & FRAME_INDEXED)
+		return readStoredIndex(in, n, index);
+
+	/* without an index, skip from header to header */
+	for (;;)
+	{
+		if (n - pos < BLOCK_HEADERSIZE or not readBlockHeader(in + pos, h))
+			return false;
+
+		addIndexEntry(index, pos, rawoffset, h.type, h.table, h.flags);
+		if (h.type == BLOCK_END)
+			return true;
+
+		pos += BLOCK_HEADERSIZE;
+		if (n - pos < h.packsize)
+			return false;
+		pos += h.packsize;
+		rawoffset += h.rawsize;
+	}
+}
+
+// returns the number of the block in `index` holding byte `rawoffset` of the
+// original, or of the end block if it's past the end
+size_t findBlock(const std::vector<indexentry_t>& index, uint64_t rawoffset)
+{
+	/* the last block starting at or before `rawoffset` */
+	auto after = std::upper_bound(index.begin(), index.end(), rawoffset,
+	                              [](uint64_t raw, const indexentry_t& e)
+	                              { return raw < e.rawoffset; });
+
+	return (after - index.begin()) - 1;
+}
+
+// decodes block `block` listed in `index` into `out`, fetching the code of
+// any earlier block it reuses through the index. returns false if it's corrupt
+bool decodeIndexedBlock(const uint8_t* in,
+                        const std::vector<indexentry_t>& index, size_t block,
+                        uint8_t* out, blockscratch_t& scratch,
+                        const codetable_t* user, metrics* stats)
+{
+	uint8_t previous[256];
+	blockheader_t h;
+
+	if (block + 1 >= index.size())
+		return false;
+
+	/* the block must fit before the next one, in both files */
+	const indexentry_t& e = index[block];
+	const indexentry_t& next = index[block + 1];
+	if (not readBlockHeader(in + e.offset, h) or h.type == BLOCK_END
+	    or next.offset - e.offset - BLOCK_HEADERSIZE < h.packsize
+	    or next.rawoffset - e.rawoffset != h.rawsize)
+		return false;
+
+	if (h.type == BLOCK_HUFFMAN and h.table == TABLE_PREVIOUS)
+	{
+		if (e.table == INDEX_NOTABLE or e.table >= block)
+			return false;
+
+		const indexentry_t& t = index[e.table];
+		blockheader_t th;
+		if (not readBlockHeader(in + t.offset, th)
+		    or index[e.table + 1].offset - t.offset - BLOCK_HEADERSIZE
+		       < th.packsize
+		    or readBlockLengths(th, in + t.offset + BLOCK_HEADERSIZE,
+		                        previous) == 0)
+			return false;
+	}
+
+	return decodeBlock(h, in + e.offset + BLOCK_HEADERSIZE, out, scratch, user,
+	                   previous, stats);
+}
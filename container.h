@@ -0,0 +1,561 @@
+/// \file container.h
+/// \brief defines the block-framed file format
+///
+/// A framed file is a short file header followed by a sequence of blocks, each
+/// of which can be decoded on its own: every block header carries the block's
+/// original size, the size of what follows it, and where its code table comes
+/// from. The sequence ends with a block of type BLOCK_END, which may be
+/// followed by an index of where every block starts, so that any part of the
+/// original can be found without reading what comes before it.
+
+
+#ifndef CONTAINER_H
+#define CONTAINER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "context.h"
+#include "huffcode.h"
+#include "metrics.h"
+#include "runs.h"
+#include "tables.h"
+#include "transform.h"
+
+using std::size_t;
+using std::uint8_t;
+using std::uint32_t;
+using std::uint64_t;
+
+/// \brief first bytes of a framed file
+///
+/// first bytes of a framed file. The first byte can't be confused with the
+/// flag byte which starts a histogram or canonical header.
+#define FRAME_MAGIC "HUFB"
+/// \brief version of the framed format written by this program
+#define FRAME_VERSION 1
+/// \brief bytes in a file header: magic, version, flags
+#define FRAME_HEADERSIZE 6
+/// \brief bytes in a block header: type, flags, table, raw size, packed size
+#define BLOCK_HEADERSIZE 11
+/// \brief block size used when none is given
+#define BLOCK_DEFAULTSIZE (1 << 20)
+/// \brief largest block size either side will accept
+#define BLOCK_MAXSIZE (1 << 28)
+/// \brief number of symbols in the alphabet of a BLOCK_WIDE block
+#define BLOCK_WIDESYMBOLS 65536
+/// \brief shortest limit on the codes of a BLOCK_WIDE block
+///
+/// shortest limit on the codes of a BLOCK_WIDE block: enough to give every
+/// one of its BLOCK_WIDESYMBOLS symbols a code, so that a wide block can
+/// always be coded, whatever the limit asked for
+#define BLOCK_WIDEMINBITS 16
+/// \brief last bytes of a framed file with an index
+#define INDEX_MAGIC "HUFX"
+/// \brief bytes in an index entry: block offset, raw offset, table block
+#define INDEX_ENTRYSIZE 20
+/// \brief bytes after the index entries: entry count, magic
+#define INDEX_TRAILERSIZE 12
+/// \brief index entry `table` of a block with no earlier table to reuse
+#define INDEX_NOTABLE 0xFFFFFFFF
+
+/// \brief flags in the file header
+///
+/// flags in the file header, which say what the file holds besides blocks
+enum frameflag_t : uint8_t
+{
+	/// an index follows the end block: an indexentry_t for every block and
+	/// then the end block (each stored as 64-bit offset, 64-bit raw offset,
+	/// 32-bit table, little-endian), then the number of entries (64-bit) and
+	/// INDEX_MAGIC
+	FRAME_INDEXED = 0x01
+};
+
+/// \brief what a block contains
+///
+/// what a block contains
+enum blocktype_t : uint8_t
+{
+	BLOCK_END = 0,     ///< no more blocks follow
+	BLOCK_HUFFMAN = 1, ///< Huffman codes for `rawsize` bytes
+	BLOCK_RAW = 2      ///< `rawsize` bytes, stored as they are
+};
+
+/// \brief flags which change how a block's codes are laid out
+///
+/// flags which change how a block's codes are laid out
+enum blockflag_t : uint8_t
+{
+	/// the codes are split into INTERLEAVE_STREAMS streams, byte `i` of the
+	/// block in stream `i % INTERLEAVE_STREAMS`. The code lengths are followed
+	/// by the sizes of all but the last stream (32-bit little-endian), then
+	/// the streams themselves
+	BLOCK_INTERLEAVED = 0x01,
+	/// each byte is coded with a code chosen by the byte before it (see
+	/// context.h). The payload is a packed context model (see
+	/// packContextModel) and then the codes, in one stream. Only allowed with
+	/// TABLE_INLINE, and not with BLOCK_INTERLEAVED or BLOCK_RUNS
+	BLOCK_CONTEXT = 0x02,
+	/// the block is coded as 16-bit little-endian symbols rather than bytes,
+	/// for data such as 16-bit samples whose bytes mean little on their own.
+	/// The payload is the packed lengths (see packLengths) of all
+	/// BLOCK_WIDESYMBOLS symbols, then the codes of the `rawsize / 2`
+	/// symbols in one stream, then the last byte as it is if `rawsize` is
+	/// odd. Only allowed with TABLE_INLINE, and with no other flag
+	BLOCK_WIDE = 0x04,
+	/// the block is coded as runs (see runs.h): the payload is the packed
+	/// lengths (see packLengths) of all RUN_SYMBOLS symbols, then the codes
+	/// of the block's run-length form in one stream. Only allowed with
+	/// TABLE_INLINE, and with no other flag but transforms
+	BLOCK_RUNS = 0x08,
+	/// the block's bytes were delta coded (see deltaEncode) before anything
+	/// else, and are decoded back after everything else
+	BLOCK_DELTA = 0x10,
+	/// the block's bytes went through the Burrows-Wheeler transform (see
+	/// bwtEncode) after any delta coding. The payload starts with the row
+	/// bwtEncode returned (32-bit little-endian), then is laid out as the
+	/// other flags say
+	BLOCK_BWT = 0x20,
+	/// the block's bytes were move-to-front coded (see mtfEncode) after any
+	/// other transform, just before being coded
+	BLOCK_MTF = 0x40
+};
+
+/// \brief the flags which transform a block's bytes before they're coded
+///
+/// the flags which transform a block's bytes before they're coded, always in
+/// the order delta, BWT, move-to-front. They can be added to any block but a
+/// BLOCK_RAW or BLOCK_WIDE one, and change only which bytes are coded, not
+/// how
+#define BLOCK_TRANSFORMS (BLOCK_DELTA | BLOCK_BWT | BLOCK_MTF)
+
+/// \brief where a block's code table comes from
+///
+/// where a block's code table comes from. Any other value is the ID of a
+/// static table (see tables.h), and the payload is just the codes
+enum tableref_t : uint8_t
+{
+	TABLE_INLINE = 0,  ///< packed canonical code lengths start the payload
+	TABLE_PREVIOUS = 1 ///< the code of the last earlier block which
+	                   ///< stores one (see storesTable)
+};
+
+/// \brief the fields at the start of every block
+///
+/// the fields at the start of every block, stored in this order with the
+/// sizes little-endian
+struct blockheader_t
+{
+	/// \brief what the block contains, see blocktype_t
+	///
+	/// what the block contains, see blocktype_t
+	uint8_t type;
+	/// \brief flags which change how the block is coded, see blockflag_t
+	///
+	/// flags which change how the block is coded, see blockflag_t
+	uint8_t flags;
+	/// \brief where the block's code table comes from, see tableref_t
+	///
+	/// where the block's code table comes from, see tableref_t
+	uint8_t table;
+	/// \brief number of bytes the block decodes to
+	///
+	/// number of bytes the block decodes to
+	uint32_t rawsize;
+	/// \brief number of bytes of payload following the block header
+	///
+	/// number of bytes of payload following the block header
+	uint32_t packsize;
+};
+
+/// \brief working memory for encoding and decoding blocks
+///
+/// working memory for encodeBlock and decodeBlock. Passing the same one to
+/// every call keeps its buffers around, so that once they are big enough,
+/// coding a block allocates nothing.
+struct blockscratch_t
+{
+	/// \brief working memory for choosing code lengths
+	///
+	/// working memory for choosing code lengths
+	pmscratch_t lengths;
+	/// \brief decode tables, rebuilt for each block
+	///
+	/// decode tables, rebuilt for each block
+	decodetable_t table;
+	/// \brief nodes of the code tree the decode tables are built from
+	///
+	/// nodes of the code tree the decode tables are built from
+	nodearena arena;
+	/// \brief counts of each pair of bytes, for planContext
+	///
+	/// counts of each pair of bytes (see countPairs), for planContext
+	std::vector<uint32_t> pairs;
+	/// \brief decode tables of each group of a context-coded block
+	///
+	/// decode tables of each group of a context-coded block, rebuilt for
+	/// each block
+	decodetable_t grouptables[CONTEXT_MAXGROUPS];
+	/// \brief the group tables of a context-coded block, joined up
+	///
+	/// the group tables of a context-coded block, joined up for
+	/// decodeContextCodes
+	contexttable_t contexttable;
+	/// \brief code lengths of a BLOCK_WIDE block
+	///
+	/// code lengths of a BLOCK_WIDE block, BLOCK_WIDESYMBOLS of them once
+	/// one has been coded (its symbol counts go in `pairs`)
+	std::vector<uint8_t> widelengths;
+	/// \brief codes of a BLOCK_WIDE block
+	///
+	/// codes of a BLOCK_WIDE block, as written
+	std::vector<huffcode_t> widemap;
+	/// \brief codes of a BLOCK_WIDE block, ready for encodeSymbols
+	///
+	/// codes of a BLOCK_WIDE block, ready for encodeSymbols
+	std::vector<streamcode_t> widecodes;
+	/// \brief a block's bytes part way through its transforms
+	///
+	/// a block's bytes part way through its transforms (see
+	/// BLOCK_TRANSFORMS), in either direction
+	std::vector<uint8_t> transformed;
+	/// \brief the sort bwtEncode works in, or where bwtDecode's rows lead
+	///
+	/// the sort bwtEncode works in, or where bwtDecode's rows lead
+	std::vector<uint32_t> transformwork;
+};
+
+/// \brief how a block is going to be coded
+///
+/// how a block is going to be coded: its byte counts, and the type, table and
+/// code lengths chosen for it by planBlock and chooseBlock
+struct blockplan_t
+{
+	/// \brief number of times each byte appears in the block
+	///
+	/// number of times each byte appears in the block
+	uint32_t hist[256];
+	/// \brief the code lengths the block will be coded with
+	///
+	/// the code lengths the block will be coded with (if it's coded at all)
+	uint8_t lengths[256];
+	/// \brief the block's type, see blocktype_t
+	///
+	/// the block's type, see blocktype_t
+	uint8_t type;
+	/// \brief where the block's code comes from, see tableref_t
+	///
+	/// where the block's code comes from, see tableref_t
+	uint8_t table;
+	/// \brief whether the block is coded with `model`
+	///
+	/// whether the block is coded with `model`, as a BLOCK_CONTEXT block
+	bool context;
+	/// \brief payload size of the block coded with `model`
+	///
+	/// number of payload bytes the block takes up coded with `model`, or 0
+	/// if it has no model
+	size_t contextsize;
+	/// \brief the block's order-1 context model, if planContext made one
+	///
+	/// the block's order-1 context model, if planContext made one
+	contextmodel_t model;
+	/// \brief whether the block is coded as runs
+	///
+	/// whether the block is coded as runs with `runlengths`, as a BLOCK_RUNS
+	/// block
+	bool runs;
+	/// \brief payload size of the block coded as runs
+	///
+	/// number of payload bytes the block takes up coded as runs, or 0 if
+	/// planRuns hasn't found a code for them
+	size_t runsize;
+	/// \brief number of times each symbol appears in the block's runs
+	///
+	/// number of times each symbol appears in the run-length form of the
+	/// block, if planRuns counted them
+	uint32_t runhist[RUN_SYMBOLS];
+	/// \brief the code lengths of the block's runs
+	///
+	/// the code lengths the block's run-length form would be coded with
+	uint8_t runlengths[RUN_SYMBOLS];
+	/// \brief the transforms the block's bytes went through
+	///
+	/// the transforms (see BLOCK_TRANSFORMS) the block's bytes went through
+	/// before being planned, if planTransforms was given any
+	uint8_t transforms = 0;
+	/// \brief the row bwtEncode returned, if `transforms` has BLOCK_BWT
+	///
+	/// the row bwtEncode returned, if `transforms` has BLOCK_BWT
+	uint32_t bwtindex = 0;
+	/// \brief the block's bytes after its transforms
+	///
+	/// the block's bytes after its transforms, which are what's coded, if
+	/// `transforms` has any
+	std::vector<uint8_t> transformed;
+};
+
+/// \brief where a block is, in both the framed file and the original
+///
+/// where a block is, in both the framed file and the original, as stored in
+/// an index or found by scanning the block headers
+struct indexentry_t
+{
+	/// \brief where the block's header starts in the framed file
+	///
+	/// where the block's header starts in the framed file
+	uint64_t offset;
+	/// \brief where the block's bytes start in the original
+	///
+	/// where the block's bytes start in the original, which is also the total
+	/// size of the blocks before it
+	uint64_t rawoffset;
+	/// \brief the block whose code a TABLE_PREVIOUS block would reuse
+	///
+	/// the number of the last block up to and including this one with a
+	/// TABLE_INLINE code, or INDEX_NOTABLE if there isn't one
+	uint32_t table;
+};
+
+/// \brief what chooseBlock remembers from one block to the next
+///
+/// the code of the last block given its own table, which later blocks may
+/// reuse rather than store a table of their own
+struct blockhistory_t
+{
+	/// \brief whether any block has been given its own table yet
+	///
+	/// whether any block has been given its own table yet
+	bool valid = false;
+	/// \brief the code lengths of that block
+	///
+	/// the code lengths of that block
+	uint8_t lengths[256];
+};
+
+/// \brief writes a file header to `out`
+///
+/// writes a FRAME_HEADERSIZE-byte file header to `out`, with `flags` (see
+/// frameflag_t)
+void writeFrameHeader(uint8_t* out, uint8_t flags = 0);
+
+/// \brief checks that `in` starts with a file header this program can read
+///
+/// returns true if the FRAME_HEADERSIZE bytes at `in` are a file header of a
+/// supported version
+bool readFrameHeader(const uint8_t* in);
+
+/// \brief writes a block header to `out`
+///
+/// writes the BLOCK_HEADERSIZE-byte form of `h` to `out`
+void writeBlockHeader(uint8_t* out, const blockheader_t& h);
+
+/// \brief reads a block header from `in`
+///
+/// reads the BLOCK_HEADERSIZE bytes at `in` into `h`, returns false if the
+/// header is invalid
+bool readBlockHeader(const uint8_t* in, blockheader_t& h);
+
+/// \brief largest number of bytes encodeBlock can produce
+///
+/// largest number of bytes (header included) that encodeBlock can produce for
+/// a block of `rawsize` bytes with codes up to `maxbits` long, or
+/// encodeWideBlock if `flags` has BLOCK_WIDE
+size_t maxBlockSize(size_t rawsize, int maxbits, uint8_t flags = 0);
+
+/// \brief transforms a block's bytes before it's planned
+///
+/// puts the `n` bytes at `in` through the transforms in `transforms` (see
+/// BLOCK_TRANSFORMS) into `plan.transformed`, and records them in `plan`.
+/// The time taken is added to `stats`, if given. returns the bytes the block
+/// should be planned from: `plan.transformed`, or `in` if there are no
+/// transforms. Blocks given a static table with planTable aren't transformed
+const uint8_t* planTransforms(const uint8_t* in, size_t n, uint8_t transforms,
+                              blockplan_t& plan, blockscratch_t& scratch,
+                              metrics* stats = nullptr);
+
+/// \brief counts a block's bytes and finds the best code for them
+///
+/// fills `plan` with the byte counts of the `n` bytes at `in` and the best
+/// length-limited code for them, to be coded with a table of their own.
+/// The time taken is added to `stats`, if given. returns false if `maxbits`
+/// is too short for the block
+bool planBlock(const uint8_t* in, size_t n, int maxbits, blockplan_t& plan,
+               blockscratch_t& scratch, metrics* stats = nullptr);
+
+/// \brief finds the best order-1 context model for a planned block
+///
+/// counts the pairs of bytes in the `n` bytes at `in` (after planBlock has
+/// planned them) and fills `plan.model` with a context model for them, with
+/// codes up to `maxbits` long, so that chooseBlock can weigh coding the block
+/// with it. The time taken is added to `stats`, if given. returns false if
+/// there's no model for the block, which is then coded as planBlock planned
+bool planContext(const uint8_t* in, size_t n, int maxbits, blockplan_t& plan,
+                 blockscratch_t& scratch, metrics* stats = nullptr);
+
+/// \brief finds the best code for a planned block's run-length form
+///
+/// counts the symbols of the run-length form (see runs.h) of the `n` bytes
+/// at `in` (after planBlock has planned them) and fills `plan.runlengths`
+/// with the best code for them up to `maxbits` long, so that chooseBlock can
+/// weigh coding the block as runs. The time taken is added to `stats`, if
+/// given. returns false if there's no such code, in which case the block is
+/// coded as planBlock planned
+bool planRuns(const uint8_t* in, size_t n, int maxbits, blockplan_t& plan,
+              blockscratch_t& scratch, metrics* stats = nullptr);
+
+/// \brief plans a block to be coded with a static table
+///
+/// fills `plan` so that the block is coded with `table`, which needs nothing
+/// counted first
+void planTable(blockplan_t& plan, const codetable_t& table);
+
+/// \brief decides how a planned block is best stored
+///
+/// estimates the size of the planned block of `n` bytes coded with its own
+/// table, with the table in `history`, with its context model (if planContext
+/// made one), as runs (if planRuns found a code), and stored raw, and changes
+/// `plan` to whichever is smallest.
+/// `history` is updated if the block gets its own order-0 table. Blocks must
+/// be chosen in the order they're written, since a block reusing a table
+/// depends on the one which stored it
+void chooseBlock(blockplan_t& plan, size_t n, uint8_t flags,
+                 blockhistory_t& history);
+
+/// \brief writes a block as planned
+///
+/// writes a block header and payload for the `n` bytes at `in`, coded as
+/// `plan` says, to `out`, which must have room for maxBlockSize bytes.
+/// `flags` (see blockflag_t) chooses how the codes are laid out, unless the
+/// block is coded with its context model or as runs, which have layouts of
+/// their own. `in` is always the block's own bytes: if `plan` has transforms,
+/// what's coded is `plan.transformed`, and `in` is only stored if the block
+/// is stored raw.
+/// The block, its payload and the time taken are added to `stats`, if given.
+/// returns the number of bytes written
+size_t writeBlock(const uint8_t* in, size_t n, uint8_t* out, uint8_t flags,
+                  const blockplan_t& plan, metrics* stats = nullptr);
+
+/// \brief encodes the `n` bytes at `in` as a whole block at `out`
+///
+/// builds a length-limited canonical code for the `n` bytes at `in`, and
+/// writes a block header, the code lengths and the codes to `out`, which must
+/// have room for maxBlockSize bytes, or stores the block raw if that's
+/// smaller. `flags` (see blockflag_t) chooses how the codes are laid out.
+/// returns the number of bytes written, or 0 if `maxbits` is too short for
+/// the block
+size_t encodeBlock(const uint8_t* in, size_t n, int maxbits, uint8_t* out,
+                   uint8_t flags = 0);
+
+/// \brief encodes a whole block, working in `scratch`
+///
+/// same as encodeBlock, but works in `scratch` rather than allocating its
+/// own working memory. If `table` is given, the block is coded with it instead
+/// (so `maxbits` is ignored, and no code lengths are written), which saves
+/// counting the bytes first
+size_t encodeBlock(const uint8_t* in, size_t n, int maxbits, uint8_t* out,
+                   uint8_t flags, blockscratch_t& scratch,
+                   const codetable_t* table = nullptr);
+
+/// \brief encodes the `n` bytes at `in` as a BLOCK_WIDE block at `out`
+///
+/// counts the `n / 2` 16-bit little-endian symbols at `in`, builds a
+/// length-limited canonical code for them of up to `maxbits` bits (or
+/// BLOCK_WIDEMINBITS, if that's longer), and writes a BLOCK_WIDE block
+/// header, the code lengths and the codes to `out`, which must have room for
+/// maxBlockSize bytes, or stores the block raw if that's smaller. The block,
+/// its payload and the time taken are added to `stats`, if given. returns
+/// the number of bytes written
+size_t encodeWideBlock(const uint8_t* in, size_t n, int maxbits, uint8_t* out,
+                       blockscratch_t& scratch, metrics* stats = nullptr);
+
+/// \brief reads the code lengths a block stores for itself
+///
+/// fills `lengths` from the payload at `in` of a block with header `h` which
+/// has a TABLE_INLINE code. returns the number of bytes they (and the row
+/// of a BLOCK_BWT block, which comes first) take up, or 0 if the block has
+/// no lengths of its own (including BLOCK_CONTEXT, BLOCK_WIDE and BLOCK_RUNS
+/// blocks, whose codes can't be reused) or they're corrupt
+size_t readBlockLengths(const blockheader_t& h, const uint8_t* in,
+                        uint8_t lengths[256]);
+
+/// \brief whether later blocks may reuse a block's code
+///
+/// returns true if the block with header `h` stores the code which a later
+/// TABLE_PREVIOUS block would reuse
+bool storesTable(const blockheader_t& h);
+
+/// \brief decodes a block's payload
+///
+/// decodes the `h.packsize` bytes of payload at `in` (for the block with
+/// header `h`) into the `h.rawsize` bytes at `out`. returns false if the
+/// payload is corrupt, or if the block reuses an earlier block's table
+bool decodeBlock(const blockheader_t& h, const uint8_t* in, uint8_t* out);
+
+/// \brief decodes a block's payload, working in `scratch`
+///
+/// same as decodeBlock, but builds the code tree and decode tables in
+/// `scratch`, so that a caller decoding many blocks can keep its memory from
+/// block to block. Blocks coded with a table loaded from a file can only be
+/// decoded if that table is passed as `user`, and blocks with TABLE_PREVIOUS
+/// only if the code lengths of the block they refer to (see
+/// readBlockLengths) are passed as `previous`. The block, its payload and
+/// the time taken are added to `stats`, if given
+bool decodeBlock(const blockheader_t& h, const uint8_t* in, uint8_t* out,
+                 blockscratch_t& scratch, const codetable_t* user = nullptr,
+                 const uint8_t* previous = nullptr, metrics* stats = nullptr);
+
+/// \brief adds a block to an index being built
+///
+/// appends the entry for a block of type `type` with table `table` and
+/// flags `flags`, whose header is at `offset` in the framed file and whose
+/// bytes start at `rawoffset` in the original, to `index`. Blocks must be
+/// added in order, followed by the end block
+void addIndexEntry(std::vector<indexentry_t>& index, uint64_t offset,
+                   uint64_t rawoffset, uint8_t type, uint8_t table,
+                   uint8_t flags);
+
+/// \brief number of bytes writeIndex produces for `entries` entries
+///
+/// number of bytes writeIndex produces for `entries` entries, trailer
+/// included
+size_t indexSize(size_t entries);
+
+/// \brief writes an index out
+///
+/// writes the entries of `index` (see FRAME_INDEXED), then the trailer, to
+/// `out`, which must have room for indexSize bytes. returns the number of
+/// bytes written
+size_t writeIndex(const std::vector<indexentry_t>& index, uint8_t* out);
+
+/// \brief finds where every block of a framed file is
+///
+/// fills `index` with an entry for every block of the `n`-byte framed file at
+/// `in`, and a last one for the end block (whose `rawoffset` is the size of
+/// the original). The index at the end of the file is read if it has one,
+/// which touches nothing else; otherwise the block headers are scanned.
+/// returns false if the file or its index is malformed
+bool readIndex(const uint8_t* in, size_t n, std::vector<indexentry_t>& index);
+
+/// \brief finds the block holding a byte of the original
+///
+/// returns the number of the block in `index` (as filled by readIndex) which
+/// holds byte `rawoffset` of the original, or the number of the end block if
+/// it's past the end
+size_t findBlock(const std::vector<indexentry_t>& index, uint64_t rawoffset);
+
+/// \brief decodes one block of a framed file, found through its index
+///
+/// decodes block `block` of the framed file at `in`, as listed in `index`
+/// (by readIndex), into `out`, which must have room for the block's raw
+/// size. Unlike decodeBlock, a block reusing an earlier block's table gets it
+/// through the index, so blocks can be decoded in any order. `user` and
+/// `stats` are as for decodeBlock. returns false if the block is corrupt
+bool decodeIndexedBlock(const uint8_t* in,
+                        const std::vector<indexentry_t>& index, size_t block,
+                        uint8_t* out, blockscratch_t& scratch,
+                        const codetable_t* user = nullptr,
+                        metrics* stats = nullptr);
+
+#endif /* CONTAINER_H */
@@ -0,0 +1,222 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "canonical.h"
+#include "context.h"
+#include "huffcode.h"
+
+
+// adds the count of byte `b` after byte `a` in the `n` bytes at `in` to
+// `pairs[a * 256 + b]`, the first byte counting as following a 0
+void countPairs(uint32_t* pairs, const uint8_t* in, size_t n)
+{
+	uint32_t prev = 0;
+
+	for (size_t i = 0; i < n; i++)
+	{
+		pairs[prev << 8 | in[i]]++;
+		prev = in[i];
+	}
+}
+
+// adds up the pairs of every context in each group into `hist`
+static void groupCounts(uint32_t hist[][256], size_t ngroups,
+                        const uint8_t groups[256], const uint32_t* pairs,
+                        const int* active, size_t nactive)
+{
+	std::memset(hist, 0, ngroups * sizeof(hist[0]));
+	for (size_t a = 0; a < nactive; a++)
+	{
+		const uint32_t* row = pairs + active[a] * 256;
+		uint32_t* h = hist[groups[active[a]]];
+		for (int s = 0; s < 256; s++)
+			h[s] += row[s];
+	}
+}
+
+// clusters the contexts seen in `pairs` into at most `groups` groups of
+// contexts followed by similar bytes, and finds a code for each group of up
+// to `maxbits` bits. returns false if there's nothing to model or no code
+bool buildContextModel(contextmodel_t& model, const uint32_t* pairs,
+                       size_t groups, int maxbits, pmscratch_t& scratch)
+{
+	uint32_t hist[CONTEXT_MAXGROUPS][256];
+	/* cost[s][g] is about how many bits byte s takes in group g */
+	float cost[256][CONTEXT_MAXGROUPS];
+	uint64_t totals[256];
+	int active[256];
+	size_t nactive = 0;
+
+	model.ngroups = 0;
+	std::memset(model.groups, 0, sizeof(model.groups));
+
+	/* only contexts which actually occur need a group */
+	for (int c = 0; c < 256; c++)
+	{
+		totals[c] = 0;
+		for (int s = 0; s < 256; s++)
+			totals[c] += pairs[c * 256 + s];
+		if (totals[c])
+			active[nactive++] = c;
+	}
+	if (nactive == 0)
+		return false;
+
+	/* the busiest contexts start off a group each */
+	std::sort(active, active + nactive,
+	          [&](int a, int b) { return totals[a] > totals[b]; });
+	groups = std::min(std::min(groups, nactive), (size_t)CONTEXT_MAXGROUPS);
+	for (size_t g = 0; g < groups; g++)
+		model.groups[active[g]] = g;
+	for (size_t a = groups; a < nactive; a++)
+		model.groups[active[a]] = 0;
+	std::memset(hist, 0, sizeof(hist));
+	for (size_t g = 0; g < groups; g++)
+		std::memcpy(hist[g], pairs + active[g] * 256, sizeof(hist[g]));
+
+	/* then every context moves to the group which codes it best, and the */
+	/* groups' counts are made again from the contexts now in them */
+	for (int pass = 0; pass < CONTEXT_PASSES and groups > 1; pass++)
+	{
+		for (size_t g = 0; g < groups; g++)
+		{
+			uint64_t total = 0;
+			for (int s = 0; s < 256; s++)
+				total += hist[g][s];
+
+			/* bytes the group hasn't seen get a code a little longer */
+			/* than its rarest, rather than none at all */
+			float bits = std::log2((float)total + 1);
+			for (int s = 0; s < 256; s++)
+				cost[s][g] = bits - std::log2(hist[g][s] + 0.5f);
+		}
+
+		for (size_t a = 0; a < nactive; a++)
+		{
+			const uint32_t* row = pairs + active[a] * 256;
+			float score[CONTEXT_MAXGROUPS] = {0};
+
+			for (int s = 0; s < 256; s++)
+			{
+				if (row[s] == 0)
+					continue;
+				for (size_t g = 0; g < groups; g++)
+					score[g] += row[s] * cost[s][g];
+			}
+
+			model.groups[active[a]] = std::min_element(score, score + groups)
+			                          - score;
+		}
+
+		groupCounts(hist, groups, model.groups, pairs, active, nactive);
+	}
+
+	/* groups which lost all their contexts are dropped */
+	uint8_t renumber[CONTEXT_MAXGROUPS];
+	size_t used = 0;
+	for (size_t g = 0; g < groups; g++)
+	{
+		renumber[g] = used;
+		for (size_t a = 0; a < nactive; a++)
+			if (model.groups[active[a]] == g)
+			{
+				used++;
+				break;
+			}
+	}
+	for (size_t a = 0; a < nactive; a++)
+		model.groups[active[a]] = renumber[model.groups[active[a]]];
+	groupCounts(hist, used, model.groups, pairs, active, nactive);
+
+	for (size_t g = 0; g < used; g++)
+		if (!getLimitedLengths(model.lengths[g], hist[g], 256,
+		                       std::min(maxbits, CONTEXT_MAXBITS), scratch))
+			return false;
+
+	model.ngroups = used;
+	return true;
+}
+
+// number of bytes of codes for `pairs` coded with `model`, or 0 if some pair
+// has no code
+size_t contextCodedSize(const contextmodel_t& model, const uint32_t* pairs)
+{
+	uint64_t bits = 0;
+
+	for (int c = 0; c < 256; c++)
+	{
+		const uint8_t* lengths = model.lengths[model.groups[c]];
+		for (int s = 0; s < 256; s++)
+		{
+			if (pairs[c * 256 + s] and lengths[s] == 0)
+				return 0;
+			bits += (uint64_t)pairs[c * 256 + s] * lengths[s];
+		}
+	}
+
+	return (bits + 7) / 8;
+}
+
+// writes `model` to `out`, returns the number of bytes written
+size_t packContextModel(const contextmodel_t& model, uint8_t* out)
+{
+	uint8_t* pos = out;
+
+	*pos++ = model.ngroups;
+
+	/* with one group, every context is in it */
+	if (model.ngroups > 1)
+	{
+		for (int c = 0; c < 256; c += 2)
+			*pos++ = model.groups[c] | model.groups[c + 1] << 4;
+	}
+
+	for (size_t g = 0; g < model.ngroups; g++)
+		pos += packLengths(model.lengths[g], 256, pos);
+
+	return pos - out;
+}
+
+// fills `model` from at most `avail` bytes at `in`, returns the number of
+// bytes read or 0 if they're corrupt
+size_t unpackContextModel(const uint8_t* in, size_t avail,
+                          contextmodel_t& model)
+{
+	size_t pos = 1;
+
+	if (avail < 1 or in[0] == 0 or in[0] > CONTEXT_MAXGROUPS)
+		return 0;
+	model.ngroups = in[0];
+
+	if (model.ngroups == 1)
+		std::memset(model.groups, 0, sizeof(model.groups));
+	else
+	{
+		if (avail - pos < 128)
+			return 0;
+		for (int c = 0; c < 256; c += 2, pos++)
+		{
+			model.groups[c] = in[pos] & 0x0F;
+			model.groups[c + 1] = in[pos] >> 4;
+			if (model.groups[c] >= model.ngroups
+			    or model.groups[c + 1] >= model.ngroups)
+				return 0;
+		}
+	}
+
+	for (size_t g = 0; g < model.ngroups; g++)
+	{
+		size_t used = unpackLengths(in + pos, avail - pos, model.lengths[g],
+		                            256);
+		if (used == 0)
+			return 0;
+		pos += used;
+
+		for (int s = 0; s < 256; s++)
+			if (model.lengths[g][s] > CONTEXT_MAXBITS)
+				return 0;
+	}
+
+	return pos;
+}
@@ -0,0 +1,108 @@
+/// \file context.h
+/// \brief defines the order-1 context model used by context-coded blocks
+///
+/// An order-0 code gives each byte the same code wherever it appears. Text
+/// and logs are far more predictable given the byte before: after a 'q'
+/// almost anything but 'u' is rare. A context model codes each byte with a
+/// code chosen by the byte before it (its context). A code for each of the
+/// 256 contexts would cost more to store than most blocks save, so contexts
+/// whose next bytes look alike are clustered into at most CONTEXT_MAXGROUPS
+/// groups, each with one code, and only the group of each context and the
+/// code of each group are stored.
+
+
+#ifndef CONTEXT_H
+#define CONTEXT_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "canonical.h"
+#include "huffcode.h"
+
+using std::size_t;
+using std::uint8_t;
+using std::uint32_t;
+
+/// \brief most groups a context model may have
+///
+/// most groups a context model may have, which lets a context's group be
+/// stored in 4 bits
+#define CONTEXT_MAXGROUPS 16
+/// \brief longest code a context model may use
+///
+/// longest code a context model may use: as long as the decode tables can
+/// resolve without walking a code tree, so that the tree each group's table
+/// is built from needn't be kept
+#define CONTEXT_MAXBITS (DECODE_ROOTBITS + DECODE_SUBBITS)
+/// \brief bytes of input per group that buildContextModel aims for
+///
+/// bytes of input per group that buildContextModel aims for, so that the codes
+/// of small blocks don't cost more to store than they save
+#define CONTEXT_GROUPBYTES 4096
+/// \brief number of times buildContextModel reassigns the contexts
+#define CONTEXT_PASSES 4
+/// \brief largest number of bytes packContextModel can produce
+#define CONTEXT_MAXHEADER (1 + 128 + CONTEXT_MAXGROUPS * CANON_MAXHEADER)
+
+/// \brief the codes a block is coded with under an order-1 context model
+///
+/// the codes a block is coded with under an order-1 context model: which group
+/// each context is in, and the code lengths of each group
+struct contextmodel_t
+{
+	/// \brief number of groups, 0 if there is no model
+	///
+	/// number of groups, 1 to CONTEXT_MAXGROUPS, or 0 if there is no model
+	uint8_t ngroups;
+	/// \brief the group of each context
+	///
+	/// the group of each context, that is of the byte before the one coded.
+	/// The first byte of a block has context 0
+	uint8_t groups[256];
+	/// \brief the code lengths of each group
+	///
+	/// the canonical code lengths of each group
+	uint8_t lengths[CONTEXT_MAXGROUPS][256];
+};
+
+/// \brief adds the number of times each pair of bytes appears at `in`
+///
+/// counts the `n` bytes at `in` by the byte before them, adding the count of
+/// byte `b` after byte `a` to `pairs[a * 256 + b]` (which the caller zeroes
+/// first). The first byte is counted as following a 0
+void countPairs(uint32_t* pairs, const uint8_t* in, size_t n);
+
+/// \brief clusters the contexts of a block and finds the code of each group
+///
+/// fills `model` with up to `groups` groups of contexts, clustered so that
+/// the contexts in each group are followed by similar bytes according to the
+/// pair counts in `pairs` (from countPairs), and the best code for each group
+/// no longer than `maxbits` (or CONTEXT_MAXBITS, if that's shorter). returns
+/// false if there is nothing to model or the codes can't be made that short
+bool buildContextModel(contextmodel_t& model, const uint32_t* pairs,
+                       size_t groups, int maxbits, pmscratch_t& scratch);
+
+/// \brief number of bytes the codes for `pairs` take up under `model`
+///
+/// number of bytes of codes for the pairs counted in `pairs` when coded with
+/// `model`, or 0 if some pair has no code
+size_t contextCodedSize(const contextmodel_t& model, const uint32_t* pairs);
+
+/// \brief writes a context model out
+///
+/// writes `model` to `out`, which must have room for CONTEXT_MAXHEADER bytes:
+/// the number of groups, then (with more than one group) the group of each
+/// context in 4 bits, low bits first, then the packed lengths (see
+/// packLengths) of each group. returns the number of bytes written
+size_t packContextModel(const contextmodel_t& model, uint8_t* out);
+
+/// \brief inverse of packContextModel
+///
+/// fills `model` from at most `avail` bytes at `in`, returns the number of
+/// bytes read, or 0 if they're corrupt or use codes longer than
+/// CONTEXT_MAXBITS
+size_t unpackContextModel(const uint8_t* in, size_t avail,
+                          contextmodel_t& model);
+
+#endif /* CONTEXT_H */
@@ -0,0 +1,297 @@
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "fileio.h"
+
+/* size of the output buffer; writes at least this big skip it */
+#define OUT_BUFSIZE (1 << 20)
+
+
+mapfile::mapfile()
+{
+	fd = -1;
+	base = nullptr;
+	length = 0;
+}
+
+mapfile::~mapfile()
+{
+	close();
+}
+
+// maps the whole of the file at `path` for reading, returns false on failure
+bool mapfile::open(const char* path, bool sequential)
+{
+	struct stat st;
+
+	close();
+
+	fd = ::open(path, O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	if (fstat(fd, &st) != 0)
+	{
+		close();
+		return false;
+	}
+
+	/* empty files can't be mapped, but there's nothing to read anyway */
+	length = st.st_size;
+	if (length == 0)
+		return true;
+
+	void* p = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (p == MAP_FAILED)
+	{
+		length = 0;
+		close();
+		return false;
+	}
+	base = (uint8_t*)p;
+
+	madvise(base, length, sequential ? MADV_SEQUENTIAL : MADV_WILLNEED);
+
+	return true;
+}
+
+void mapfile::close()
+{
+	if (base != nullptr)
+		munmap(base, length);
+	if (fd >= 0)
+		::close(fd);
+
+	fd = -1;
+	base = nullptr;
+	length = 0;
+}
+
+void mapfile::randomAccess()
+{
+	if (base != nullptr)
+		madvise(base, length, MADV_RANDOM);
+}
+
+bool mapfile::is_open()
+{
+	return fd >= 0;
+}
+
+const uint8_t* mapfile::data()
+{
+	return base;
+}
+
+size_t mapfile::size()
+{
+	return length;
+}
+
+
+outfile::outfile()
+{
+	fd = -1;
+	failed = false;
+	written = 0;
+	base = nullptr;
+	length = 0;
+}
+
+outfile::~outfile()
+{
+	close();
+}
+
+// creates (or truncates) the file at `path` for writing
+bool outfile::open(const char* path)
+{
+	close();
+
+	/* "-" is standard output, which can be written to but not mapped */
+	if (path[0] == '-' and path[1] == '\0')
+		fd = dup(STDOUT_FILENO);
+	else
+		fd = ::open(path, O_RDWR | O_CREAT | O_TRUNC, 0666);
+	failed = (fd < 0);
+	written = 0;
+	buffer.reserve(OUT_BUFSIZE);
+
+	return fd >= 0;
+}
+
+// flushes, unmaps and closes the file, returns false if any write failed
+bool outfile::close()
+{
+	if (fd < 0)
+		return not failed;
+
+	flush();
+
+	if (base != nullptr)
+		munmap(base, length);
+	if (::close(fd) != 0)
+		failed = true;
+
+	fd = -1;
+	base = nullptr;
+	length = 0;
+
+	return not failed;
+}
+
+bool outfile::is_open()
+{
+	return fd >= 0;
+}
+
+bool outfile::good()
+{
+	return fd >= 0 and not failed;
+}
+
+// appends `n` bytes to the file through the buffer
+bool outfile::write(const void* p, size_t n)
+{
+	if (not good() or base != nullptr)
+	{
+		failed = true;
+		return false;
+	}
+
+	/* big writes go straight out, after whatever's already buffered */
+	if (n >= OUT_BUFSIZE)
+	{
+		if (not flush())
+			return false;
+
+		const uint8_t* pos = (const uint8_t*)p;
+		while (n > 0)
+		{
+			ssize_t put = ::write(fd, pos, n);
+			if (put < 0 and errno == EINTR)
+				continue;
+			if (put < 0)
+			{
+				failed = true;
+				return false;
+			}
+			pos += put;
+			n -= put;
+			written += put;
+		}
+		return true;
+	}
+
+	if (buffer.size() + n > OUT_BUFSIZE and not flush())
+		return false;
+
+	buffer.insert(buffer.end(), (const uint8_t*)p, (const uint8_t*)p + n);
+	written += n;
+	return true;
+}
+
+bool outfile::put(uint8_t c)
+{
+	return write(&c, 1);
+}
+
+// grows the file by `n` bytes (after anything already written) and maps them
+uint8_t* outfile::map(size_t n)
+{
+	if (not flush() or base != nullptr)
+		return nullptr;
+
+	if (ftruncate(fd, written + n) != 0)
+	{
+		failed = true;
+		return nullptr;
+	}
+
+	/* mappings have to start on a page boundary */
+	uint64_t start = written - written % sysconf(_SC_PAGESIZE);
+	length = written + n - start;
+	if (length == 0)
+		return nullptr;
+
+	void* p = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+	               start);
+	if (p == MAP_FAILED)
+	{
+		length = 0;
+		failed = true;
+		return nullptr;
+	}
+	base = (uint8_t*)p;
+
+	uint8_t* out = base + (written - start);
+	written += n;
+	return out;
+}
+
+bool outfile::mappable()
+{
+	struct stat st;
+
+	/* shared mappings need the file open for reading as well */
+	return fd >= 0 and fstat(fd, &st) == 0 and S_ISREG(st.st_mode)
+	       and (fcntl(fd, F_GETFL) & O_ACCMODE) == O_RDWR;
+}
+
+uint64_t outfile::size()
+{
+	return written;
+}
+
+// writes out everything in `buffer`
+bool outfile::flush()
+{
+	const uint8_t* pos = buffer.data();
+	size_t n = buffer.size();
+
+	if (fd < 0 or failed)
+		return false;
+
+	while (n > 0)
+	{
+		ssize_t put = ::write(fd, pos, n);
+		if (put < 0 and errno == EINTR)
+			continue;
+		if (put < 0)
+		{
+			failed = true;
+			break;
+		}
+		pos += put;
+		n -= put;
+	}
+
+	buffer.clear();
+	return not failed;
+}
+
+
+// reads until `n` bytes have been read from `fd` or it runs out. returns the
+// number of bytes read, or -1 on failure
+long readAll(int fd, uint8_t* p, size_t n)
+{
+	size_t got = 0;
+
+	while (got < n)
+	{
+		ssize_t r = ::read(fd, p + got, n - got);
+		if (r < 0 and errno == EINTR)
+			continue;
+		if (r < 0)
+			return -1;
+		if (r == 0)
+			break;
+		got += r;
+	}
+
+	return got;
+}
@@ -0,0 +1,183 @@
+/// \file fileio.h
+/// \brief defines the memory-mapped input and buffered/mapped output files
+///
+/// Input files are memory-mapped whole, so that the coders can run straight
+/// over the file's bytes; pipes, which can't be, are read a block at a time.
+/// Output files are written either through a large buffer, or (when the final
+/// size is known up front) by mapping the presized file and writing into
+/// memory.
+
+
+#ifndef FILEIO_H
+#define FILEIO_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+using std::size_t;
+using std::uint8_t;
+using std::uint64_t;
+
+/// \brief a read-only, memory-mapped input file
+///
+/// a read-only, memory-mapped input file
+class mapfile
+{
+public:
+	/// \brief constructor initializes a closed file
+	///
+	/// constructor initializes a closed file
+	mapfile();
+	/// \brief unmaps and closes the file
+	///
+	/// unmaps and closes the file
+	~mapfile();
+
+	/// \brief maps the whole of the file at `path`
+	///
+	/// maps the whole of the file at `path` for reading, hinting to the kernel
+	/// that it will be read from front to back if `sequential` is set (or
+	/// that all of it will be needed soon, otherwise). returns false on failure
+	bool open(const char* path, bool sequential = true);
+	/// \brief hints that only scattered parts of the file will be read
+	///
+	/// hints to the kernel that only scattered parts of the open file will be
+	/// read, so that it reads ahead of none of them
+	void randomAccess();
+	/// \brief unmaps and closes the file
+	///
+	/// unmaps and closes the file
+	void close();
+	/// \brief indicates whether the file was opened successfully
+	///
+	/// indicates whether the file was opened successfully
+	bool is_open();
+
+	/// \brief the file's bytes
+	///
+	/// the file's bytes (nullptr for an empty file)
+	const uint8_t* data();
+	/// \brief number of bytes in the file
+	///
+	/// number of bytes in the file
+	size_t size();
+
+private:
+	/// \brief file descriptor, or -1 when closed
+	///
+	/// file descriptor, or -1 when closed
+	int fd;
+	/// \brief start of the mapping
+	///
+	/// start of the mapping
+	uint8_t* base;
+	/// \brief length of the mapping
+	///
+	/// length of the mapping
+	size_t length;
+};
+
+/// \brief a write-only output file
+///
+/// a write-only output file, written either through a large buffer with
+/// write() or, once map() is called, directly in memory
+class outfile
+{
+public:
+	/// \brief constructor initializes a closed file
+	///
+	/// constructor initializes a closed file
+	outfile();
+	/// \brief flushes, unmaps and closes the file
+	///
+	/// flushes, unmaps and closes the file
+	~outfile();
+
+	/// \brief creates (or truncates) the file at `path` for writing
+	///
+	/// creates (or truncates) the file at `path` for writing, or writes to
+	/// standard output if `path` is "-". returns false on failure
+	bool open(const char* path);
+	/// \brief flushes, unmaps and closes the file
+	///
+	/// flushes, unmaps and closes the file, returns false if any write failed
+	bool close();
+	/// \brief indicates whether the file was opened successfully
+	///
+	/// indicates whether the file was opened successfully
+	bool is_open();
+	/// \brief indicates whether every write so far has succeeded
+	///
+	/// indicates whether every write so far has succeeded
+	bool good();
+
+	/// \brief appends `n` bytes to the file
+	///
+	/// appends `n` bytes to the file through the buffer (large writes skip
+	/// the buffer), returns false on failure
+	bool write(const void* p, size_t n);
+	/// \brief appends a single byte to the file
+	///
+	/// appends a single byte to the file, returns false on failure
+	bool put(uint8_t c);
+
+	/// \brief grows the file by `n` bytes and maps them for writing
+	///
+	/// grows the file by `n` bytes (after anything already written) and maps
+	/// them, so they can be filled in directly in any order. returns nullptr
+	/// on failure (always, for standard output). may only be called once
+	uint8_t* map(size_t n);
+
+	/// \brief indicates whether map() can be used
+	///
+	/// indicates whether map() can be used, which it can only for regular
+	/// files opened for reading and writing (so not for standard output,
+	/// unless it was opened that way)
+	bool mappable();
+
+	/// \brief number of bytes written (or mapped) so far
+	///
+	/// number of bytes written (or mapped) so far
+	uint64_t size();
+
+private:
+	/// \brief file descriptor, or -1 when closed
+	///
+	/// file descriptor, or -1 when closed
+	int fd;
+	/// \brief set once a write has failed
+	///
+	/// set once a write has failed
+	bool failed;
+	/// \brief bytes written (or mapped) so far
+	///
+	/// bytes written (or mapped) so far
+	uint64_t written;
+	/// \brief pending bytes which haven't been written yet
+	///
+	/// pending bytes which haven't been written yet
+	std::vector<uint8_t> buffer;
+	/// \brief start of the mapping made by map(), if any
+	///
+	/// start of the mapping made by map(), if any
+	uint8_t* base;
+	/// \brief length of that mapping
+	///
+	/// length of that mapping
+	size_t length;
+
+	/// \brief writes out everything in `buffer`
+	///
+	/// writes out everything in `buffer`
+	bool flush();
+};
+
+/// \brief reads up to `n` bytes from the file descriptor `fd`
+///
+/// reads from `fd` until `n` bytes have been read into `p` or it runs out,
+/// so that pipes deliver whole blocks. returns the number of bytes read
+/// (less than `n` only at the end of the input), or -1 on failure
+long readAll(int fd, uint8_t* p, size_t n);
+
+#endif /* FILEIO_H */
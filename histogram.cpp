@@ -0,0 +1,69 @@
+#include <cstring>
+
+#include "bitio.h"
+#include "histogram.h"
+
+
+// adds the number of times each byte appears in the `n` bytes at `in` to
+// `hist`. consecutive bytes land in different sub-histograms, so a run of one
+// byte value doesn't serialize on a single counter
+void countBytes(uint32_t hist[256], const uint8_t* in, size_t n)
+{
+	uint32_t sub[HIST_TABLES][256];
+	const uint8_t* end = in + n;
+
+	memset(sub, 0, sizeof(sub));
+
+	/* two words per pass, each byte to the next table along. written out */
+	/* in full, since compilers don't reliably unroll the loop form */
+	while (end - in >= 16)
+	{
+		uint64_t a = load64(in);
+		uint64_t b = load64(in + 8);
+		in += 16;
+
+		sub[0][(uint8_t)a]++;
+		sub[1][(uint8_t)(a >> 8)]++;
+		sub[2][(uint8_t)(a >> 16)]++;
+		sub[3][(uint8_t)(a >> 24)]++;
+		sub[0][(uint8_t)(a >> 32)]++;
+		sub[1][(uint8_t)(a >> 40)]++;
+		sub[2][(uint8_t)(a >> 48)]++;
+		sub[3][(uint8_t)(a >> 56)]++;
+
+		sub[0][(uint8_t)b]++;
+		sub[1][(uint8_t)(b >> 8)]++;
+		sub[2][(uint8_t)(b >> 16)]++;
+		sub[3][(uint8_t)(b >> 24)]++;
+		sub[0][(uint8_t)(b >> 32)]++;
+		sub[1][(uint8_t)(b >> 40)]++;
+		sub[2][(uint8_t)(b >> 48)]++;
+		sub[3][(uint8_t)(b >> 56)]++;
+	}
+
+	/* whatever's left over */
+	for (int t = 0; in < end; t = (t + 1) % HIST_TABLES)
+		sub[t][*in++]++;
+
+	for (int c = 0; c < 256; c++)
+		for (int t = 0; t < HIST_TABLES; t++)
+			hist[c] += sub[t][c];
+}
+
+// adds the number of times each symbol appears in the `n` symbols at `in` to
+// `hist`. sub-histograms of a larger alphabet would cost more to clear and
+// add up than they save, so its symbols go straight into `hist`
+template <typename symbol_t>
+void countSymbols(uint32_t* hist, const uint8_t* in, size_t n)
+{
+	for (size_t i = 0; i < n; i++, in += sizeof(symbol_t))
+		hist[loadSymbol<symbol_t>(in)]++;
+}
+
+template <>
+void countSymbols<uint8_t>(uint32_t* hist, const uint8_t* in, size_t n)
+{
+	countBytes(hist, in, n);
+}
+
+template void countSymbols<uint16_t>(uint32_t*, const uint8_t*, size_t);
@@ -0,0 +1,42 @@
+/// \file histogram.h
+/// \brief defines the byte-counting kernel used to build histograms
+///
+/// Counting bytes one at a time into a single table stalls whenever the same
+/// byte repeats, since each increment has to wait for the previous store to
+/// the same counter. The kernel here spreads consecutive bytes over several
+/// sub-histograms and adds them together at the end.
+
+
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <cstddef>
+#include <cstdint>
+
+using std::size_t;
+using std::uint8_t;
+using std::uint32_t;
+
+/// \brief number of sub-histograms the bytes are spread over
+///
+/// number of sub-histograms the bytes are spread over. countBytes is unrolled
+/// for exactly this many.
+#define HIST_TABLES 4
+
+/// \brief adds the number of times each byte appears at `in` to `hist`
+///
+/// counts the `n` bytes at `in`, adding the count of each byte value to the
+/// matching entry of `hist` (which the caller zeroes first, or keeps adding
+/// to). Reads 16 bytes at a time, spread over HIST_TABLES sub-histograms.
+void countBytes(uint32_t hist[256], const uint8_t* in, size_t n);
+
+/// \brief adds the number of times each symbol appears at `in` to `hist`
+///
+/// counts the `n` symbols of type `symbol_t` at `in` (bytes, or wider symbols
+/// stored little-endian), adding the count of each to the matching entry of
+/// `hist`, which has one for every symbol of the alphabet. Bytes are counted
+/// with countBytes. Instantiated for uint8_t and uint16_t
+template <typename symbol_t>
+void countSymbols(uint32_t* hist, const uint8_t* in, size_t n);
+
+#endif /* HISTOGRAM_H */
@@ -1,15 +1,26 @@
 #include <iostream>
+#include <algorithm>
+#include <cstring>
 using std::cerr;
 
+#include "bitio.h"
 #include "minheap.h"
 #include "huffcode.h"
 #include "node.h"
+#include "runs.h"
 
-#define BUFSIZE (256/8)
+#define CHUNKSIZE (1 << 16)
+/* largest alphabet getCodeLengths works on without allocating: enough for */
+/* bytes and the symbols of a run-coded block */
+#define STACK_SYMBOLS 512
 
 
-void getHuffMapFromTree(huffcode_t* map, node* root, uint8_t bitcnt, uint128_t bits)
+void getHuffMapFromTree(huffcode_t* map, node* root, uint8_t bitcnt, uint64_t bits)
 {
+	/* single-symbol trees only have a left child */
+	if (root == nullptr)
+		return;
+
 	if (root->isLeaf())
 	{
 		map[root->ch].bitcnt = bitcnt;
@@ -43,182 +54,613 @@ void cleanTree(node* n)
 	delete n;
 }
 
-// given an array which maps bytes to huffman codes, read from fin (start at 0)
-// and write out to fout (starting where it was left at)
-void writeHuffman(huffcode_t huffmap[256], ifstream& fin, ofstream& fout)
+// fills `codes` with the bit-reversed codes of the first `n` entries of
+// `map`, returns false if any code is longer than 64 bits
+bool getStreamCodes(streamcode_t* codes, const huffcode_t* map, size_t n)
 {
-	/* stores a byte read in from infile */
-	uint8_t inputbyte;
-	/* buffers the huffman codes until a byte can be written */
-	uint8_t buffer[BUFSIZE] = {0};
-	/* keeps track of the number of bits shifted into buffer */
-	int bufferedbits = 0;
+	for (size_t i = 0; i < n; i++)
+	{
+		if (map[i].bitcnt > 64)
+			return false;
+
+		/* the first (most significant) bit of the code goes first */
+		codes[i].bits = 0;
+		codes[i].bitcnt = map[i].bitcnt;
+		for (int b = 0; b < map[i].bitcnt; b++)
+			codes[i].bits |= (uint64_t)((map[i].bits >> b) & 0x1)
+			                 << (map[i].bitcnt - 1 - b);
+	}
 
+	return true;
+}
+
+// writes the codes for the `n` bytes at `in` to `out` (which needs room for
+// all of them, plus 8 spare bytes), zero-padding the last byte. returns the
+// number of bytes written
+size_t encodeCodes(const streamcode_t codes[256], const uint8_t* in, size_t n,
+                   uint8_t* out, size_t stride)
+{
+	return encodeSymbols<uint8_t>(codes, in, n, out, stride);
+}
 
-	/* restart the reading of fin, clearing any flags before doing so */
-	fin.clear();
-	fin.seekg(0);
-	if (not fin)
+// writes the codes for `n` symbols taken `stride` apart from `in` to `out`,
+// returns the number of bytes written
+template <typename symbol_t>
+size_t encodeSymbols(const streamcode_t* codes, const uint8_t* in, size_t n,
+                     uint8_t* out, size_t stride)
+{
+	bitwriter w = {out, 0, 0};
+
+	for (size_t i = 0; i < n; i++, in += stride * sizeof(symbol_t))
 	{
-		cerr << "Error: failed to seek to beginning of infile for Pass 2\n";
-		return;
+		const streamcode_t& code = codes[loadSymbol<symbol_t>(in)];
+		w.put(code.bits, code.bitcnt);
+	}
+	w.flush();
+
+	return w.pos - out;
+}
+
+template size_t encodeSymbols<uint8_t>(const streamcode_t*, const uint8_t*,
+                                       size_t, uint8_t*, size_t);
+template size_t encodeSymbols<uint16_t>(const streamcode_t*, const uint8_t*,
+                                        size_t, uint8_t*, size_t);
+
+// writes the codes for the `n` bytes at `in` to `out`, each from the codes
+// of the group of the byte before it, returns the number of bytes written
+size_t encodeContextCodes(const streamcode_t codes[][256],
+                          const uint8_t groups[256], const uint8_t* in,
+                          size_t n, uint8_t* out)
+{
+	/* the codes for each context, to save looking up its group every time */
+	const streamcode_t* bycontext[256];
+	bitwriter w = {out, 0, 0};
+	uint8_t prev = 0;
+
+	for (int c = 0; c < 256; c++)
+		bycontext[c] = codes[groups[c]];
+
+	for (size_t i = 0; i < n; i++)
+	{
+		const streamcode_t& code = bycontext[prev][in[i]];
+		w.put(code.bits, code.bitcnt);
+		prev = in[i];
 	}
+	w.flush();
+
+	return w.pos - out;
+}
 
-	/* continuously read a character until either fin is unreadable or fout has
-	 * problems */
-	fin.get((char&)inputbyte);
-	while (fin.gcount() > 0 and fout)
+// writes the codes for the run-length form of the `n` bytes at `in` to
+// `out`, returns the number of bytes written
+size_t encodeRuns(const streamcode_t* codes, const uint8_t* in, size_t n,
+                  uint8_t* out)
+{
+	bitwriter w = {out, 0, 0};
+
+	for (size_t i = 0; i < n; )
 	{
-		/* shift in the bits for the byte's huffman code, */
-		/* one at a time, from left to right */
-		uint128_t bits = huffmap[inputbyte].bits;
-		uint8_t bitcnt = huffmap[inputbyte].bitcnt;
-		for (int i = bitcnt - 1; i >= 0; i--)
-		{
-			size_t bufpos = bufferedbits / 8;
-			size_t bitpos = bufferedbits % 8;
-			buffer[bufpos] |= ((bits >> i) & 0x1) << bitpos;
-			bufferedbits++;
-		}
+		size_t run = runLength(in, i, n);
+
+		w.put(codes[in[i]].bits, codes[in[i]].bitcnt);
+		i += 1 + run;
 
-		/* as long as a byte can be written, */
-		/* write it and clear it from the buffer */
-		while (bufferedbits >= 8)
+		/* the digits of the run, least significant first */
+		for (; run; run = (run - 1) >> 1)
 		{
-			fout.put(buffer[0]);
-			for (int i = 0; i < (BUFSIZE-1); i++)
-				buffer[i] = buffer[i+1];
-			bufferedbits -= 8;
+			const streamcode_t& code = codes[(run & 1) ? RUN_A : RUN_B];
+			w.put(code.bits, code.bitcnt);
 		}
+	}
+	w.flush();
+
+	return w.pos - out;
+}
 
-		/* try to fetch the next byte*/
-		fin.get((char&)inputbyte);
+// given an array which maps bytes to huffman codes, translate the `n` bytes
+// at `in` and write them out to fout (starting where it was left at)
+void writeHuffman(huffcode_t huffmap[256], const uint8_t* in, size_t n,
+                  outfile& fout)
+{
+	/* codes in the order they're shifted into the stream */
+	streamcode_t codes[256];
+	/* buffers the codes for a chunk of input */
+	vector<uint8_t> outbuf;
+	bitwriter w = {nullptr, 0, 0};
+	uint8_t maxbits = 0;
+
+	if (not getStreamCodes(codes, huffmap, 256))
+	{
+		cerr << "Error: Huffman codes are too long to encode\n";
+		return;
+	}
+
+	/* make room for a whole chunk of the longest code (plus a spare word) */
+	for (size_t i = 0; i < 256; i++)
+		if (codes[i].bitcnt > maxbits)
+			maxbits = codes[i].bitcnt;
+	outbuf.resize((size_t)CHUNKSIZE * maxbits / 8 + 8);
+
+	/* translate a chunk of input at a time until either it runs out or */
+	/* fout has problems */
+	for (size_t pos = 0; pos < n and fout.good(); pos += CHUNKSIZE)
+	{
+		const uint8_t* chunk = in + pos;
+		size_t len = (n - pos < CHUNKSIZE) ? n - pos : CHUNKSIZE;
+
+		w.pos = outbuf.data();
+		for (size_t i = 0; i < len; i++)
+			w.put(codes[chunk[i]].bits, codes[chunk[i]].bitcnt);
+
+		/* whole words are written; leftover bits wait in the accumulator */
+		fout.write(outbuf.data(), w.pos - outbuf.data());
 	}
 
 	/* the last byte in the encoded file says how many trailing zero's are in */
 	/* the final encoded byte (second-to-last physical byte in the file) */
-	if (fin.gcount() == 0)
+	w.pos = outbuf.data();
+	uint8_t padbits = w.flush();
+	fout.write(outbuf.data(), w.pos - outbuf.data());
+	fout.put(padbits);
+
+	if (not fout.good())
+		cerr << "Error encountered while writing encoded data to outfile.\n";
+}
+
+
+// returns the length of the longest code in the subtree below `n`
+static int treeDepth(node* n)
+{
+	if (n == nullptr or n->isLeaf())
+		return 0;
+
+	int left = treeDepth(n->left);
+	int right = treeDepth(n->right);
+	return 1 + (left > right ? left : right);
+}
+
+// fills the `width`-bit wide (sub-)table at `base` for the subtree `n`, which
+// is reached by the `depth` bits of `path` (first bit least significant)
+static void fillDecodeTable(decodetable_t& table, uint32_t base, int width,
+                            node* n, int depth, uint32_t path)
+{
+	/* single-symbol trees only have a left child */
+	if (n == nullptr)
+		return;
+
+	if (n->isLeaf())
 	{
-		/* empty the buffer */
-		if (bufferedbits > 0)
+		/* a lone leaf at the root means there are no codes at all */
+		if (depth == 0)
+			return;
+
+		/* every slot whose low bits match the code decodes to this leaf */
+		decodeentry_t e = {DECODE_SYMBOL, (uint8_t)depth, n->ch, 0};
+		for (uint32_t i = path; i < (1u << width); i += (1u << depth))
+			table.entries[base + i] = e;
+		return;
+	}
+
+	/* the subtree doesn't fit in this table, so link to the rest of it */
+	if (depth == width)
+	{
+		decodeentry_t e = {DECODE_INVALID, (uint8_t)width, 0, 0};
+
+		/* primary table links to a sub-table, sized for the subtree */
+		if (base == 0)
 		{
-			fout.put(buffer[0]);
-			/* only between 1 and 7 bits buffered so this will be correct */
-			fout.put(8 - bufferedbits);
+			int subwidth = treeDepth(n);
+			if (subwidth > DECODE_SUBBITS)
+				subwidth = DECODE_SUBBITS;
+
+			e.kind = DECODE_SUBTABLE;
+			e.sym = subwidth;
+			e.index = table.entries.size();
+			table.entries.resize(e.index + (1u << subwidth), decodeentry_t());
+			table.entries[base + path] = e;
+			fillDecodeTable(table, e.index, subwidth, n, 0, 0);
 		}
+		/* sub-tables hand over to the tree walker */
 		else
 		{
-			/* buffer empty already? 0 trailing bits */
-			fout.put(0);
+			e.kind = DECODE_WALK;
+			e.index = table.walks.size();
+			table.walks.push_back(n);
+			table.entries[base + path] = e;
 		}
+		return;
 	}
-	else /* fout must be bad */
+
+	fillDecodeTable(table, base, width, n->left, depth + 1, path);
+	fillDecodeTable(table, base, width, n->right, depth + 1, path | (1u << depth));
+}
+
+// fills `table` so that codes can be resolved several bits at a time,
+// returns false if the tree has codes too long for the table decoder
+bool buildDecodeTable(decodetable_t& table, node* root)
+{
+	table.entries.assign(1u << DECODE_ROOTBITS, decodeentry_t());
+	table.walks.clear();
+
+	if (treeDepth(root) > DECODE_MAXBITS)
+		return false;
+
+	fillDecodeTable(table, 0, DECODE_ROOTBITS, root, 0, 0);
+	return true;
+}
+
+// decodes one symbol from the front of `r` (which must have been refilled)
+// into `ch`. returns the number of bits consumed, or 0 if the bits don't form
+// a code in the table
+template <typename symbol_t>
+static inline unsigned decodeSymbol(const decodetable_t& table, bitreader& r,
+                                    symbol_t& ch)
+{
+	const decodeentry_t* e;
+	unsigned bitcnt;
+
+	e = &table.entries[r.acc & ((1u << DECODE_ROOTBITS) - 1)];
+	if (e->kind == DECODE_SYMBOL)
 	{
-		cerr << "Error encountered while writing encoded data to outfile.\n";
+		r.consume(e->bitcnt);
+		ch = (symbol_t)e->sym;
+		return e->bitcnt;
+	}
+
+	if (e->kind != DECODE_SUBTABLE)
+		return 0;
+
+	/* long code: resolve the next few bits with the sub-table */
+	bitcnt = e->bitcnt;
+	r.consume(e->bitcnt);
+	e = &table.entries[e->index + (r.acc & ((1u << e->sym) - 1))];
+	bitcnt += e->bitcnt;
+	r.consume(e->bitcnt);
+
+	if (e->kind == DECODE_SYMBOL)
+	{
+		ch = (symbol_t)e->sym;
+		return bitcnt;
+	}
+
+	if (e->kind != DECODE_WALK)
+		return 0;
+
+	/* very long code: finish it off one bit at a time */
+	node* traverse = table.walks[e->index];
+	while (traverse != nullptr and not traverse->isLeaf())
+	{
+		traverse = (r.acc & 1) ? traverse->right : traverse->left;
+		r.consume(1);
+		bitcnt++;
+	}
+
+	if (traverse == nullptr)
+		return 0;
+
+	ch = (symbol_t)traverse->ch;
+	return bitcnt;
+}
+
+// decodes exactly `n` bytes into `out` from the `inlen` bytes of codes at
+// `in`, returns false if the codes are corrupt or run past the end of `in`
+bool decodeCodes(const decodetable_t& table, const uint8_t* in, size_t inlen,
+                 uint8_t* out, size_t n)
+{
+	return decodeSymbols<uint8_t>(table, in, inlen, out, n);
+}
+
+// decodes exactly `n` symbols into `out` from the `inlen` bytes of codes at
+// `in`, returns false if the codes are corrupt or run past the end of `in`
+template <typename symbol_t>
+bool decodeSymbols(const decodetable_t& table, const uint8_t* in,
+                   size_t inlen, uint8_t* out, size_t n)
+{
+	bitreader r = {in, in + inlen, 0, 0};
+	uint64_t bitsused = 0;
+	symbol_t sym = 0;
+
+	for (size_t i = 0; i < n; i++, out += sizeof(symbol_t))
+	{
+		r.refill();
+		unsigned bitcnt = decodeSymbol(table, r, sym);
+		if (bitcnt == 0)
+			return false;
+		storeSymbol(out, sym);
+		bitsused += bitcnt;
+	}
+
+	/* anything past the end was read as zeros, so make sure none was used */
+	return bitsused <= (uint64_t)inlen * 8;
+}
+
+template bool decodeSymbols<uint8_t>(const decodetable_t&, const uint8_t*,
+                                     size_t, uint8_t*, size_t);
+template bool decodeSymbols<uint16_t>(const decodetable_t&, const uint8_t*,
+                                      size_t, uint8_t*, size_t);
+
+// fills `table` with the tables of the `ngroups` groups at `tables` end to
+// end, each symbol pointing at the table for the context it makes. returns
+// false if a group needs a tree walk
+bool buildContextTable(contexttable_t& table, const decodetable_t* tables,
+                       size_t ngroups, const uint8_t groups[256])
+{
+	uint32_t base[256];
+	size_t size = 0;
+
+	for (size_t g = 0; g < ngroups; g++)
+	{
+		if (not tables[g].walks.empty())
+			return false;
+		base[g] = size;
+		size += tables[g].entries.size();
+	}
+
+	table.entries.resize(size);
+	for (size_t g = 0; g < ngroups; g++)
+	{
+		decodeentry_t* out = table.entries.data() + base[g];
+
+		for (const decodeentry_t& e : tables[g].entries)
+		{
+			*out = e;
+			if (e.kind == DECODE_SUBTABLE)
+				out->index += base[g];
+			else if (e.kind == DECODE_SYMBOL)
+				out->index = base[groups[e.sym]];
+			out++;
+		}
+	}
+	table.start = base[groups[0]];
+
+	return true;
+}
+
+// decodes exactly `n` bytes into `out` from the `inlen` bytes of codes at
+// `in`, each with the table for the byte before it. returns false if the
+// codes are corrupt or run past the end of `in`
+bool decodeContextCodes(const contexttable_t& table, const uint8_t* in,
+                        size_t inlen, uint8_t* out, size_t n)
+{
+	const decodeentry_t* entries = table.entries.data();
+	bitreader r = {in, in + inlen, 0, 0};
+	uint64_t bitsused = 0;
+	uint32_t base = table.start;
+
+	for (size_t i = 0; i < n; i++)
+	{
+		r.refill();
+		const decodeentry_t* e =
+			&entries[base + (r.acc & ((1u << DECODE_ROOTBITS) - 1))];
+
+		/* long code: resolve the next few bits with the sub-table */
+		if (e->kind != DECODE_SYMBOL)
+		{
+			if (e->kind != DECODE_SUBTABLE)
+				return false;
+			r.consume(e->bitcnt);
+			bitsused += e->bitcnt;
+			e = &entries[e->index + (r.acc & ((1u << e->sym) - 1))];
+			if (e->kind != DECODE_SYMBOL)
+				return false;
+		}
+
+		r.consume(e->bitcnt);
+		bitsused += e->bitcnt;
+		out[i] = (uint8_t)e->sym;
+		base = e->index;
+	}
+
+	/* anything past the end was read as zeros, so make sure none was used */
+	return bitsused <= (uint64_t)inlen * 8;
+}
+
+// decodes the run-length form of exactly `n` bytes into `out` from the
+// `inlen` bytes of codes at `in`. returns false if the codes are corrupt or
+// don't add up to `n` bytes
+bool decodeRuns(const decodetable_t& table, const uint8_t* in, size_t inlen,
+                uint8_t* out, size_t n)
+{
+	bitreader r = {in, in + inlen, 0, 0};
+	uint64_t bitsused = 0;
+	size_t i = 0;
+	size_t run = 0;
+	unsigned digit = 0;
+	uint16_t sym;
+
+	/* a run isn't written out until the byte after it (or the end), since */
+	/* until then another digit could make it longer */
+	while (i + run < n)
+	{
+		r.refill();
+		unsigned bitcnt = decodeSymbol(table, r, sym);
+		if (bitcnt == 0)
+			return false;
+		bitsused += bitcnt;
+
+		if (sym < RUN_A)
+		{
+			if (run)
+				std::memset(out + i, out[i - 1], run);
+			i += run;
+			run = 0;
+			digit = 0;
+			out[i++] = (uint8_t)sym;
+		}
+		else
+		{
+			/* a run must follow a byte, and can't go past the end (which */
+			/* also keeps `digit` small) */
+			run += (size_t)(sym - RUN_A + 1) << digit++;
+			if (i == 0 or run > n - i)
+				return false;
+		}
 	}
+	if (run)
+		std::memset(out + i, out[i - 1], run);
 
+	/* anything past the end was read as zeros, so make sure none was used */
+	return bitsused <= (uint64_t)inlen * 8;
 }
 
+// decodes `n` bytes into `out` from INTERLEAVE_STREAMS streams, byte `i`
+// from stream `i % INTERLEAVE_STREAMS`, a symbol from each stream per step
+bool decodeCodesInterleaved(const decodetable_t& table,
+                            const uint8_t* const in[INTERLEAVE_STREAMS],
+                            const size_t inlen[INTERLEAVE_STREAMS],
+                            uint8_t* out, size_t n)
+{
+	bitreader r[INTERLEAVE_STREAMS];
+	uint64_t bitsused[INTERLEAVE_STREAMS];
+	size_t i = 0;
+
+	for (int s = 0; s < INTERLEAVE_STREAMS; s++)
+	{
+		r[s] = bitreader{in[s], in[s] + inlen[s], 0, 0};
+		bitsused[s] = 0;
+	}
+
+	/* written out per stream, so the four lookups are independent */
+	for (; n - i >= INTERLEAVE_STREAMS; i += INTERLEAVE_STREAMS)
+	{
+		r[0].refill();
+		r[1].refill();
+		r[2].refill();
+		r[3].refill();
+
+		unsigned b0 = decodeSymbol(table, r[0], out[i]);
+		unsigned b1 = decodeSymbol(table, r[1], out[i + 1]);
+		unsigned b2 = decodeSymbol(table, r[2], out[i + 2]);
+		unsigned b3 = decodeSymbol(table, r[3], out[i + 3]);
+		if (b0 == 0 or b1 == 0 or b2 == 0 or b3 == 0)
+			return false;
+
+		bitsused[0] += b0;
+		bitsused[1] += b1;
+		bitsused[2] += b2;
+		bitsused[3] += b3;
+	}
+
+	/* the last few bytes come from the first few streams */
+	for (int s = 0; i < n; i++, s++)
+	{
+		r[s].refill();
+		unsigned bitcnt = decodeSymbol(table, r[s], out[i]);
+		if (bitcnt == 0)
+			return false;
+		bitsused[s] += bitcnt;
+	}
+
+	/* anything past the end was read as zeros, so make sure none was used */
+	for (int s = 0; s < INTERLEAVE_STREAMS; s++)
+		if (bitsused[s] > (uint64_t)inlen[s] * 8)
+			return false;
+
+	return true;
+}
 
-// given the code tree for huffman, read code from fin (starting where it was
-// left at) and write out the actual byte to fout (start at 0)
-void readHuffman(node* root, ifstream& fin, ofstream& fout)
+// given the code tree for huffman, translate the `n` bytes of codes at `in`
+// (ending with the byte which holds the number of padding bits) and write the
+// actual bytes out to fout
+void readHuffman(node* root, const uint8_t* in, size_t n, outfile& fout)
 {
-	/* stores a byte read in from infile, nextbyte stores the next one read */
-	uint8_t inputbyte, nextbyte;
-	/* buffers the huffman codes read in in byte-sized chunks at a time */
-	uint8_t buffer[BUFSIZE] = {0};
-	/* counts how many bits are in the buffer */
-	int bufferedbits;
-	/* used for traversing the code tree */
-	node* traverse = root;
-	/* indicates when terminating byte is found */
-	bool lastrun = false;
+	decodetable_t table;
+	/* buffers a chunk of the decoded output */
+	vector<uint8_t> outbuf(CHUNKSIZE);
+	size_t outlen = 0;
 
-	/* at this point, fin should be good, and at the byte immediately after */
-	/*	the histogram, ready for writing. if not, bail out */
-	if (not fin)
+	/* codes too long for the tables need the bit-at-a-time walker */
+	if (not buildDecodeTable(table, root))
 	{
-		cerr << "Error: failed to read infile after parsing histogram\n";
+		readHuffmanTree(root, in, n, fout);
 		return;
 	}
 
-	/* make sure we write the outfile from the beginning */
-	fout.seekp(0);
-	if (not fout)
+	/* the codes run up to the last byte, which holds the number of */
+	/* padding bits in the final byte of codes */
+	if (n == 0 or in[n - 1] > 7 or (n == 1 and in[0] != 0))
 	{
-		cerr << "Error: failed to write to start of outfile\n";
+		cerr << "Error: encoded data is truncated\n";
 		return;
 	}
+	uint64_t bitsleft = (uint64_t)(n - 1) * 8 - in[n - 1];
+	bitreader r = {in, in + n - 1, 0, 0};
 
-	/* start buffering data and keeping track of it. Safe to assume there */
-	/* will be at least one byte before the terminating one, so this counts */
-	/* as buffered data. */
-	fin.get((char&)buffer[0]);
-	bufferedbits = 8;
-	fin.get((char&)inputbyte);
-	while (fout and not lastrun)
+	while (bitsleft > 0 and fout.good())
 	{
-		fin.get((char&)nextbyte);
+		r.refill();
+		unsigned bitcnt = decodeSymbol(table, r, outbuf[outlen]);
+		if (bitcnt == 0 or bitcnt > bitsleft)
+		{
+			cerr << "Error: encoded data is corrupt\n";
+			break;
+		}
+		bitsleft -= bitcnt;
 
-		/* check for the terminating byte. if found, empty the buffer */
-		if (fin.gcount() == 0)
+		if (++outlen == CHUNKSIZE)
 		{
-			/* set our loop to terminate */
-			lastrun = true;
-			/* subtract terminating byte's # of trailing bits from buffer */
-			bufferedbits -= inputbyte;
+			fout.write(outbuf.data(), outlen);
+			outlen = 0;
 		}
-		/* otherwise inputbyte actually holds data and not the number of */
-		/* trailing bits (terminating byte), so add it to the buffer */
-		else
+	}
+
+	fout.write(outbuf.data(), outlen);
+}
+
+// walks the code tree one bit at a time to translate huffman codes at `in`
+// to bytes in fout. works for codes of any length
+void readHuffmanTree(node* root, const uint8_t* in, size_t n, outfile& fout)
+{
+	/* buffers a chunk of the decoded output */
+	vector<uint8_t> outbuf(CHUNKSIZE);
+	size_t outlen = 0;
+	/* position of the next bit to read */
+	uint64_t bit = 0;
+
+	if (n == 0 or in[n - 1] > 7 or (n == 1 and in[0] != 0))
+	{
+		cerr << "Error: encoded data is truncated\n";
+		return;
+	}
+	uint64_t bitcnt = (uint64_t)(n - 1) * 8 - in[n - 1];
+
+	while (bit < bitcnt and fout.good())
+	{
+		/* read a bit and traverse the tree in that dir, stopping once */
+		/* a leaf is found */
+		node* traverse = root;
+		while (traverse != nullptr and not traverse->isLeaf() and bit < bitcnt)
 		{
-			for (size_t i = 0; i < 8; i++)
-			{
-				size_t bufpos = (bufferedbits) / 8;
-				size_t bitpos = (bufferedbits) % 8;
-				buffer[bufpos] |= ((inputbyte >> i) & 0x1) << bitpos;
-				bufferedbits++;
-			}
-			inputbyte = nextbyte;
-		}
-
-		/* maintain at least 128 bits in buffer so tree traversal can make */
-		/* it from the root to the furthest leaf, unless we hit the end,  */
-		/* in which case just read 'til the buffer's empty */
-		while ((bufferedbits > (lastrun ? 0 : 127)) and fout)
-		{
-			/* read a bit and traverse the tree in that dir, stopping once */
-			/* a leaf is found */
-			while (not traverse->isLeaf())
-			{
-				uint8_t bit = buffer[0] & 1;
-				/* shift buffer down by a bit, 1 byte of buffer at a time */
-				for (int i = 0; i < BUFSIZE; i++)
-				{
-					uint8_t carrybit = (i == (BUFSIZE-1) ? 0 : buffer[i+1] & 1);
-					buffer[i] >>= 1;
-					buffer[i] |= (carrybit << 7);
-				}
-				bufferedbits--;
-				if (bit == 1)
-					traverse = traverse->right;
-				else // bit == 0
-					traverse = traverse->left;
-			}
-
-			/* once a leaf is found, write the byte out */
-			fout.put((char)traverse->ch);
-			traverse = root; /* reset the traversal back to root */
+			if ((in[bit / 8] >> (bit % 8)) & 1)
+				traverse = traverse->right;
+			else // bit == 0
+				traverse = traverse->left;
+			bit++;
+		}
+
+		if (traverse == nullptr or traverse == root or not traverse->isLeaf())
+		{
+			cerr << "Error: encoded data is corrupt\n";
+			break;
+		}
+
+		/* once a leaf is found, write the byte out */
+		outbuf[outlen] = traverse->ch;
+		if (++outlen == CHUNKSIZE)
+		{
+			fout.write(outbuf.data(), outlen);
+			outlen = 0;
 		}
 	}
+
+	fout.write(outbuf.data(), outlen);
 }
 
 // takes a histogram, makes a heap, then turns the heap into a tree for parsing
 // into a huffman code table
-node* getTreeFromHist(uint32_t hist[256])
+node* getTreeFromHist(uint32_t hist[256], nodearena* arena)
 {
-	minheap heap = minheap();
+	minheap heap;
 	node* left;
 	node* right;
 	node* top;
@@ -226,22 +668,31 @@ node* getTreeFromHist(uint32_t hist[256])
 	/* fill the heap with every histogram entry if it's nonzero */
 	for (size_t i = 0; i < 256; i++)
 		if (hist[i])
-			heap.insert(hist[i], static_cast<uint8_t>(i));
+			heap.insert(hist[i], static_cast<uint16_t>(i));
 
 	/* special case -- tree has only one node: default to code 0 */
 	if (heap.size() == 1)
 	{
-		top = new node;
-		left = heap.pop_smallest();
+		top = arena ? arena->alloc() : new node;
+		left = heap.pop_smallest(arena);
 		top->weight = left->weight;
 		top->left = left;
+		top->right = nullptr;
 		return top;
 	}
 
 	while (heap.size() > 1)
 	{
-		left = heap.pop_smallest();
-		right = heap.pop_smallest();
+		left = heap.pop_smallest(arena);
+		right = heap.pop_smallest(arena);
+
+		/* the heap keeps a copy, so an arena's node can be a temporary */
+		if (arena)
+		{
+			heap.insert(node{left, right, left->weight + right->weight, 0});
+			continue;
+		}
+
 		top = new node;
 		top->weight = left->weight + right->weight;
 		top->left = left;
@@ -249,7 +700,233 @@ node* getTreeFromHist(uint32_t hist[256])
 		heap.insert(top);
 	}
 
-	top = heap.pop_smallest();
+	top = heap.pop_smallest(arena);
 
 	return top;
 }
+
+// computes unlimited optimal code lengths for the first `n` (at most
+// MAX_SYMBOLS) entries of `hist` with Moffat and Katajainen's in-place
+// algorithm, which works on a single sorted array (`a`, with room for `n`)
+// rather than a tree, and keeps the symbols aside in `syms` (as big).
+// returns the longest
+static int getCodeLengths(uint8_t* lengths, const uint32_t* hist, size_t n,
+                          uint64_t* a, uint16_t* syms)
+{
+	long count = 0;
+
+	/* weights with the symbol in the low 16 bits, so sorting them sorts the */
+	/* symbols on weight (ties by symbol) */
+	for (size_t i = 0; i < n; i++)
+	{
+		lengths[i] = 0;
+		if (hist[i])
+			a[count++] = (uint64_t)hist[i] << 16 | i;
+	}
+	std::sort(a, a + count);
+
+	/* same special cases as getTreeFromHist: nothing, or a lone code 0 */
+	if (count == 0)
+		return 0;
+	if (count == 1)
+	{
+		lengths[a[0] & 0xffff] = 1;
+		return 1;
+	}
+
+	/* keep the symbols aside, the array is about to be reused */
+	for (long i = 0; i < count; i++)
+	{
+		syms[i] = a[i] & 0xffff;
+		a[i] >>= 16;
+	}
+
+	/* phase 1: combine the two lightest of the leaves and internal nodes, */
+	/* left to right. each internal node's slot ends up holding its weight, */
+	/* then (once it's been combined) the index of its parent */
+	long leaf = 2;
+	long root = 0;
+	a[0] += a[1];
+	for (long next = 1; next < count - 1; next++)
+	{
+		if (leaf >= count or (root < next and a[root] < a[leaf]))
+		{
+			a[next] = a[root];
+			a[root++] = next;
+		}
+		else
+			a[next] = a[leaf++];
+
+		if (leaf >= count or (root < next and a[root] < a[leaf]))
+		{
+			a[next] += a[root];
+			a[root++] = next;
+		}
+		else
+			a[next] += a[leaf++];
+	}
+
+	/* phase 2: turn parent indices into depths of the internal nodes, */
+	/* from the root (the last one) down */
+	a[count - 2] = 0;
+	for (long next = count - 3; next >= 0; next--)
+		a[next] = a[a[next]] + 1;
+
+	/* phase 3: each level's free slots go to leaves, heaviest first */
+	long avail = 1;
+	long used = 0;
+	long depth = 0;
+	long next = count - 1;
+	root = count - 2;
+	while (avail > 0)
+	{
+		while (root >= 0 and (long)a[root] == depth)
+		{
+			used++;
+			root--;
+		}
+		while (avail > used)
+		{
+			a[next--] = depth;
+			avail--;
+		}
+		avail = 2 * used;
+		depth++;
+		used = 0;
+	}
+
+	for (long i = 0; i < count; i++)
+		lengths[syms[i]] = a[i];
+
+	/* the lightest symbol is always among the deepest */
+	return a[0];
+}
+
+// same as above, with small alphabets worked out on the stack, and larger
+// ones in room allocated for them
+int getCodeLengths(uint8_t* lengths, const uint32_t* hist, size_t n)
+{
+	uint64_t small[STACK_SYMBOLS];
+	uint16_t smallsyms[STACK_SYMBOLS];
+
+	if (n <= STACK_SYMBOLS)
+		return getCodeLengths(lengths, hist, n, small, smallsyms);
+
+	vector<uint64_t> large(n);
+	vector<uint16_t> largesyms(n);
+	return getCodeLengths(lengths, hist, n, large.data(), largesyms.data());
+}
+
+// orders package-merge leaves on weight, ties by symbol
+static bool comparePMItem(const pmitem_t& a, const pmitem_t& b)
+{
+	return a.weight < b.weight or (a.weight == b.weight and a.sym < b.sym);
+}
+
+// adds 1 to the code length of every symbol inside the package-merge item
+// at `i`, once for each time it appears
+static void countPackage(const vector<pmitem_t>& pool, int i, uint8_t* lengths)
+{
+	if (pool[i].sym >= 0)
+	{
+		lengths[pool[i].sym]++;
+		return;
+	}
+
+	countPackage(pool, pool[i].left, lengths);
+	countPackage(pool, pool[i].right, lengths);
+}
+
+// computes optimal code lengths for the first `n` entries of `hist` under the
+// constraint that no code is longer than `maxbits`, using package-merge
+bool getLimitedLengths(uint8_t* lengths, const uint32_t* hist, size_t n, int maxbits)
+{
+	pmscratch_t scratch;
+
+	return getLimitedLengths(lengths, hist, n, maxbits, scratch);
+}
+
+// same as above, working in `scratch`
+bool getLimitedLengths(uint8_t* lengths, const uint32_t* hist, size_t n,
+                       int maxbits, pmscratch_t& scratch)
+{
+	/* pool of every item, and the lists of pool indices for each level */
+	vector<pmitem_t>& pool = scratch.pool;
+	vector<int>& leaves = scratch.leaves;
+	vector<int>& list = scratch.list;
+	vector<int>& merged = scratch.merged;
+	size_t used;
+
+	/* an unlimited code is usually short enough already, and much cheaper */
+	/* to make than a limited one. alphabets too big for the stack are */
+	/* worked out in `scratch` too */
+	int longest;
+	if (n <= STACK_SYMBOLS)
+		longest = getCodeLengths(lengths, hist, n);
+	else
+	{
+		scratch.weights.resize(n);
+		scratch.symbols.resize(n);
+		longest = getCodeLengths(lengths, hist, n, scratch.weights.data(),
+		                         scratch.symbols.data());
+	}
+	if (longest <= maxbits)
+		return true;
+
+	pool.clear();
+	leaves.clear();
+
+	for (size_t i = 0; i < n; i++)
+		lengths[i] = 0;
+
+	/* the leaves go first in the pool, sorted on weight (ties by symbol) */
+	for (size_t i = 0; i < n; i++)
+		if (hist[i])
+			pool.push_back(pmitem_t{hist[i], (int)i, -1, -1});
+	std::sort(pool.begin(), pool.end(), comparePMItem);
+	used = pool.size();
+	for (size_t i = 0; i < used; i++)
+		leaves.push_back(i);
+
+	/* same special cases as getTreeFromHist: nothing, or a lone code 0 */
+	if (used == 0)
+		return true;
+	if (used == 1)
+	{
+		lengths[pool[leaves[0]].sym] = 1;
+		return maxbits >= 1;
+	}
+	if (maxbits < 1 or (maxbits < 32 and ((uint64_t)1 << maxbits) < used))
+		return false;
+
+	/* start with the deepest level's list, which is just the leaves, then */
+	/* work up: pair off the list below into packages, and merge them with */
+	/* the leaves to make this level's list */
+	list.assign(leaves.begin(), leaves.end());
+	for (int level = 1; level < maxbits; level++)
+	{
+		merged.clear();
+		size_t l = 0;
+		for (size_t p = 0; p + 1 < list.size(); p += 2)
+		{
+			pmitem_t pkg = {pool[list[p]].weight + pool[list[p + 1]].weight,
+			              -1, list[p], list[p + 1]};
+
+			/* leaves go first on equal weights */
+			while (l < used and pool[leaves[l]].weight <= pkg.weight)
+				merged.push_back(leaves[l++]);
+			merged.push_back(pool.size());
+			pool.push_back(pkg);
+		}
+		while (l < used)
+			merged.push_back(leaves[l++]);
+		list.swap(merged);
+	}
+
+	/* the cheapest 2n - 2 items of the top list make up the code: every */
+	/* time a symbol appears in them, its code gets a bit longer */
+	for (size_t i = 0; i < 2 * used - 2; i++)
+		countPackage(pool, list[i], lengths);
+
+	return true;
+}
@@ -10,20 +10,40 @@
 #define HUFFCODE_H
 
 #include <cstdint>
-#include <fstream>
+#include <vector>
 
+#include "fileio.h"
 #include "node.h"
 
 using std::uint8_t;
 using std::uint32_t;
 using std::uint64_t;
-typedef unsigned __int128 uint128_t;
-using std::ifstream;
-using std::ofstream;
+using std::uint16_t;
+using std::vector;
 
-/// \brief represents a single Huffman code point, up to 128 bits long
+/// \brief number of input bits resolved by one probe of the primary decode table
+#define DECODE_ROOTBITS 11
+/// \brief maximum number of input bits resolved by one overflow sub-table
+#define DECODE_SUBBITS 11
+/// \brief longest code the table decoder can handle with a single refill
+#define DECODE_MAXBITS 56
+/// \brief largest alphabet the code builders can make a code for
 ///
-/// represents a single Huffman code point, up to 128 bits long
+/// largest alphabet the code builders (getCodeLengths, getLimitedLengths, and
+/// those in canonical.h) can make a code for: every 16-bit symbol
+#define MAX_SYMBOLS 65536
+/// \brief number of sub-streams an interleaved block is split into
+///
+/// number of sub-streams an interleaved block is split into.
+/// decodeCodesInterleaved is unrolled for exactly this many.
+#define INTERLEAVE_STREAMS 4
+
+/// \brief represents a single Huffman code point, up to 64 bits long
+///
+/// represents a single Huffman code point, up to 64 bits long. Trees built
+/// from a histogram can't get deeper than that: with at most 2^31 - 1 of each
+/// of the 256 bytes, a code longer than about 56 bits would need more bytes
+/// than the histogram can count.
 struct huffcode_t
 {
 	/// \brief indicates how many bits are in the code
@@ -35,14 +55,187 @@ struct huffcode_t
 	/// contains the bits actually in the Huffman code point.
 	/// The first bit of the huffman code is stored most significant, and the
 	/// last bit in the least significant bit of `bits`.
-	uint128_t bits;
+	uint64_t bits;
+};
+
+/// \brief a Huffman code laid out in stream order, ready for a bitwriter
+///
+/// the same code as a huffcode_t, but with its bits reversed so that the first
+/// bit of the code is the least significant, as it appears in the stream.
+struct streamcode_t
+{
+	/// \brief contains the code, first bit least significant
+	///
+	/// contains the code, first bit least significant
+	uint64_t bits;
+	/// \brief indicates how many bits are in the code
+	///
+	/// indicates how many bits are in the code
+	uint8_t bitcnt;
+};
+
+/// \brief the kinds of entry found in a decode table
+///
+/// the kinds of entry found in a decode table
+enum decodekind_t : uint8_t
+{
+	DECODE_INVALID = 0, ///< no code starts with these bits
+	DECODE_SYMBOL,      ///< a whole code: emit `sym`, consume `bitcnt` bits
+	DECODE_SUBTABLE,    ///< consume `bitcnt` bits, then probe sub-table `index`
+	DECODE_WALK         ///< consume `bitcnt` bits, then walk from `walks[index]`
+};
+
+/// \brief a single slot of a decode table
+///
+/// a single slot of a decode table. Slots are indexed by the next few bits of
+/// the stream, first bit least significant, so every code shorter than the
+/// table width fills all of the slots that share its prefix.
+struct decodeentry_t
+{
+	/// \brief what to do when this slot is hit
+	///
+	/// what to do when this slot is hit, see decodekind_t
+	uint8_t kind;
+	/// \brief number of bits consumed by this slot
+	///
+	/// number of bits consumed by this slot
+	uint8_t bitcnt;
+	/// \brief decoded symbol, or sub-table width for DECODE_SUBTABLE
+	///
+	/// decoded symbol, or sub-table width for DECODE_SUBTABLE
+	uint16_t sym;
+	/// \brief offset of a sub-table in `entries`, or index into `walks`
+	///
+	/// offset of a sub-table in `entries`, or index into `walks`. In a
+	/// contexttable_t, symbols have the offset of the table for the context
+	/// they make
+	uint32_t index;
+};
+
+/// \brief multi-bit lookup tables for decoding a Huffman code
+///
+/// a primary table resolving DECODE_ROOTBITS bits per probe, followed by
+/// overflow sub-tables for codes that are longer than that. Codes too long for
+/// a sub-table as well are finished by walking the code tree a bit at a time.
+struct decodetable_t
+{
+	/// \brief the primary table, followed by every sub-table
+	///
+	/// the primary table (the first `1 << DECODE_ROOTBITS` slots), followed by
+	/// every sub-table
+	vector<decodeentry_t> entries;
+	/// \brief tree nodes to resume a bit-at-a-time walk from
+	///
+	/// tree nodes to resume a bit-at-a-time walk from
+	vector<node*> walks;
+};
+
+/// \brief decode tables for codes chosen by the byte before
+///
+/// the decode tables of every group of a context model, laid end to end, so
+/// that each symbol's entry can also say where the table for the next symbol
+/// starts: the decoder goes from one table to the next without looking up
+/// the group of the byte it just made
+struct contexttable_t
+{
+	/// \brief every group's primary table and sub-tables, one after another
+	///
+	/// every group's primary table and sub-tables, one after another
+	vector<decodeentry_t> entries;
+	/// \brief where the table for the first symbol starts
+	///
+	/// where the table for the first symbol (which has context 0) starts
+	uint32_t start;
 };
 
 /// \brief turns a histogram into its corresponding huffman code tree
 ///
 /// takes a histogram, makes a heap, then turns the heap into a tree for parsing
-/// into a huffman code table
-node* getTreeFromHist(uint32_t hist[256]);
+/// into a huffman code table. The nodes come from `arena` if one is given
+/// (so nothing is allocated), or are allocated one at a time otherwise.
+node* getTreeFromHist(uint32_t hist[256], nodearena* arena = nullptr);
+
+/// \brief turns a histogram into optimal code lengths, with no limit
+///
+/// computes optimal (Huffman) code lengths for the first `n` entries of
+/// `hist`, where `n` is at most MAX_SYMBOLS, without building a tree: the
+/// symbols are sorted on weight and the code is worked out in place in that
+/// one array (Moffat and Katajainen's algorithm). returns the longest length
+int getCodeLengths(uint8_t* lengths, const uint32_t* hist, size_t n);
+
+/// \brief an item in one of package-merge's lists
+///
+/// an item in one of package-merge's lists: either a symbol (leaf) or a
+/// package of two items from the list below it
+struct pmitem_t
+{
+	/// \brief combined weight of the item
+	///
+	/// combined weight of the symbol, or of both halves of the package
+	uint64_t weight;
+	/// \brief symbol for a leaf, -1 for a package
+	///
+	/// symbol for a leaf, -1 for a package
+	int sym;
+	/// \brief pool index of a package's first item
+	///
+	/// pool index of a package's first item
+	int left;
+	/// \brief pool index of a package's second item
+	///
+	/// pool index of a package's second item
+	int right;
+};
+
+/// \brief working memory for getLimitedLengths
+///
+/// working memory for getLimitedLengths. Passing the same one to every call
+/// lets its buffers be reused instead of allocated again each time.
+struct pmscratch_t
+{
+	/// \brief every leaf and package made so far
+	///
+	/// every leaf and package made so far
+	vector<pmitem_t> pool;
+	/// \brief pool indices of the leaves, in order of weight
+	///
+	/// pool indices of the leaves, in order of weight
+	vector<int> leaves;
+	/// \brief pool indices of the current level's list
+	///
+	/// pool indices of the current level's list
+	vector<int> list;
+	/// \brief pool indices of the list being built for the next level
+	///
+	/// pool indices of the list being built for the next level
+	vector<int> merged;
+	/// \brief weights getCodeLengths works on, for large alphabets
+	///
+	/// weights getCodeLengths works on, for alphabets too big to work out on
+	/// the stack
+	vector<uint64_t> weights;
+	/// \brief symbols getCodeLengths keeps aside, for large alphabets
+	///
+	/// symbols getCodeLengths keeps aside, for alphabets too big to work out
+	/// on the stack
+	vector<uint16_t> symbols;
+};
+
+/// \brief turns a histogram into code lengths no longer than `maxbits`
+///
+/// computes optimal code lengths for the first `n` entries of `hist` under the
+/// constraint that no code is longer than `maxbits`. getCodeLengths is tried
+/// first, and package-merge only used if its code is too long.
+/// returns false if `maxbits` is too short to give every symbol a code
+bool getLimitedLengths(uint8_t* lengths, const uint32_t* hist, size_t n, int maxbits);
+
+/// \brief getLimitedLengths with caller-provided working memory
+///
+/// same as getLimitedLengths, but works in `scratch` (getCodeLengths
+/// included), so that repeated calls stop allocating once its buffers are
+/// big enough
+bool getLimitedLengths(uint8_t* lengths, const uint32_t* hist, size_t n,
+                       int maxbits, pmscratch_t& scratch);
 
 /// \brief anti-memory-leak weapon. aim at root of the huffman code tree
 ///
@@ -54,18 +247,133 @@ void cleanTree(node* n);
 ///
 /// fills the supplied huffmap from a tree,
 /// returns false on failure. the map is an array that gives O(1) lookup to 
-void getHuffMapFromTree(huffcode_t* map, node* root, uint8_t bits = 0, uint128_t bitcnt = 0);
+void getHuffMapFromTree(huffcode_t* map, node* root, uint8_t bits = 0, uint64_t bitcnt = 0);
+
+/// \brief converts the codes of `map` into stream order
+///
+/// fills `codes` with the bit-reversed codes of the first `n` entries of
+/// `map`, returns false if any code is longer than 64 bits
+bool getStreamCodes(streamcode_t* codes, const huffcode_t* map, size_t n);
+
+/// \brief translates `n` symbols at `in` to codes at `out`
+///
+/// writes the codes for `n` symbols of type `symbol_t` (bytes, or wider
+/// symbols stored little-endian) taken `stride` symbols apart from `in` to
+/// `out`, which needs room for all of them plus 8 spare bytes, zero-padding
+/// the last byte. `codes` has an entry for every symbol of the alphabet.
+/// returns the number of bytes written. Instantiated for uint8_t and uint16_t
+template <typename symbol_t>
+size_t encodeSymbols(const streamcode_t* codes, const uint8_t* in, size_t n,
+                     uint8_t* out, size_t stride = 1);
+
+/// \brief translates the `n` bytes at `in` to codes at `out`
+///
+/// writes the codes for `n` bytes taken `stride` apart from `in` (in[0],
+/// in[stride], ...) to `out`, which needs room for all of them plus 8 spare
+/// bytes, zero-padding the last byte. returns the number of bytes written
+size_t encodeCodes(const streamcode_t codes[256], const uint8_t* in, size_t n,
+                   uint8_t* out, size_t stride = 1);
+
+/// \brief translates the `n` bytes at `in` to codes chosen by the byte before
+///
+/// same as encodeCodes, but byte `i` is coded with the codes of group
+/// `groups[in[i - 1]]` (and the first byte with those of group `groups[0]`),
+/// where `codes[g]` are the codes of group `g`
+size_t encodeContextCodes(const streamcode_t codes[][256],
+                          const uint8_t groups[256], const uint8_t* in,
+                          size_t n, uint8_t* out);
+
+/// \brief translates the run-length form of the `n` bytes at `in` to codes
+///
+/// writes the codes for the run-length form (see runs.h) of the `n` bytes at
+/// `in` to `out`, which needs room for all of them plus 8 spare bytes,
+/// zero-padding the last byte. `codes` has an entry for each of the
+/// RUN_SYMBOLS symbols. returns the number of bytes written
+size_t encodeRuns(const streamcode_t* codes, const uint8_t* in, size_t n,
+                  uint8_t* out);
+
+/// \brief use `huffmap` to translate the `n` bytes at `in` to codes in `fout`
+///
+/// given an array which maps bytes to huffman codes, translate the `n` bytes
+/// at `in` and write them out to fout (starting where it was left at),
+/// followed by the number of padding bits in the last byte of codes
+void writeHuffman(huffcode_t huffmap[256], const uint8_t* in, size_t n,
+                  outfile& fout);
+
+/// \brief builds the lookup tables used by readHuffman from a code tree
+///
+/// fills `table` so that codes can be resolved several bits at a time,
+/// returns false if the tree has codes too long for the table decoder (in
+/// which case readHuffmanTree must be used instead)
+bool buildDecodeTable(decodetable_t& table, node* root);
+
+/// \brief translates the codes at `in` back into `n` symbols at `out`
+///
+/// decodes exactly `n` symbols of type `symbol_t` into `out` (stored
+/// little-endian, if wider than a byte) from the `inlen` bytes of codes at
+/// `in`, returns false if the codes are corrupt or run past the end of `in`.
+/// Instantiated for uint8_t and uint16_t
+template <typename symbol_t>
+bool decodeSymbols(const decodetable_t& table, const uint8_t* in,
+                   size_t inlen, uint8_t* out, size_t n);
+
+/// \brief translates the codes at `in` back into `n` bytes at `out`
+///
+/// decodes exactly `n` bytes into `out` from the `inlen` bytes of codes at
+/// `in`, returns false if the codes are corrupt or run past the end of `in`
+bool decodeCodes(const decodetable_t& table, const uint8_t* in, size_t inlen,
+                 uint8_t* out, size_t n);
+
+/// \brief builds the table decodeContextCodes uses from each group's table
+///
+/// fills `table` from the decode tables of the `ngroups` groups at `tables`,
+/// for a context model in which context `c` is in group `groups[c]`. returns
+/// false if any group has codes which need a tree walk
+bool buildContextTable(contexttable_t& table, const decodetable_t* tables,
+                       size_t ngroups, const uint8_t groups[256]);
+
+/// \brief translates codes chosen by the byte before back into `n` bytes
+///
+/// inverse of encodeContextCodes: decodes exactly `n` bytes into `out` from
+/// the `inlen` bytes of codes at `in`, each with the part of `table` for the
+/// byte decoded before it. returns false if the codes are corrupt or run
+/// past the end of `in`
+bool decodeContextCodes(const contexttable_t& table, const uint8_t* in,
+                        size_t inlen, uint8_t* out, size_t n);
+
+/// \brief translates the codes of a run-length form back into `n` bytes
+///
+/// inverse of encodeRuns: decodes the run-length form of exactly `n` bytes
+/// from the `inlen` bytes of codes at `in`, writing out each run as it ends.
+/// returns false if the codes are corrupt, describe more or fewer than `n`
+/// bytes, or run past the end of `in`
+bool decodeRuns(const decodetable_t& table, const uint8_t* in, size_t inlen,
+                uint8_t* out, size_t n);
+
+/// \brief translates INTERLEAVE_STREAMS streams of codes back into `n` bytes
+///
+/// decodes exactly `n` bytes into `out`, where byte `i` comes from stream
+/// `i % INTERLEAVE_STREAMS` (the `inlen[s]` bytes of codes at `in[s]`). The
+/// streams are decoded side by side, a symbol from each per step, so their
+/// dependency chains overlap. returns false if any stream is corrupt or runs
+/// past its end
+bool decodeCodesInterleaved(const decodetable_t& table,
+                            const uint8_t* const in[INTERLEAVE_STREAMS],
+                            const size_t inlen[INTERLEAVE_STREAMS],
+                            uint8_t* out, size_t n);
 
-/// \brief use `huffmap` to translates bytes of `fin` to codes in `fout`
+/// \brief use the code tree to translate the huffman codes at `in` to bytes in `fout`
 ///
-/// given an array which maps bytes to huffman codes, read from fin (start at 0)
-/// and write out to fout (starting where it was left at)
-void writeHuffman(huffcode_t huffmap[256], ifstream& fin, ofstream& fout);
+/// given the code tree for huffman, translate the `n` bytes of codes at `in`
+/// (ending with the byte which holds the number of padding bits) and write
+/// the actual bytes out to fout. Codes are resolved with a lookup table,
+/// falling back to readHuffmanTree if the tree is too deep for one.
+void readHuffman(node* root, const uint8_t* in, size_t n, outfile& fout);
 
-/// \brief use `huffmap` to translates huffman codes of `fin` to bytes in `fout`
+/// \brief bit-at-a-time version of readHuffman
 ///
-/// given the code tree for huffman, read code from fin (starting where it was
-/// left at) and write out the actual byte to fout (start at 0)
-void readHuffman(node* root, ifstream& fin, ofstream& fout);
+/// same as readHuffman, but walks the code tree one bit at a time. Slow, but
+/// works for any code length.
+void readHuffmanTree(node* root, const uint8_t* in, size_t n, outfile& fout);
 
 #endif
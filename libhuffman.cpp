@@ -0,0 +1,354 @@
+#include <cstring>
+
+#include "libhuffman.h"
+
+
+huffcontext::huffcontext(int maxbits, size_t blocksize, bool interleave,
+                         bool index, bool context, int symbolbits,
+                         bool runs, uint8_t transforms)
+{
+	this->maxbits = maxbits;
+	this->blocksize = blocksize;
+	this->symbolbits = symbolbits;
+	this->runs = runs;
+	this->transforms = transforms;
+
+	/* a 16-bit symbol mustn't straddle two blocks */
+	if (symbolbits == 16 and blocksize < BLOCK_MAXSIZE)
+		this->blocksize += blocksize % 2;
+	flags = interleave ? BLOCK_INTERLEAVED : 0;
+	indexed = index;
+	this->context = context;
+	grew = 0;
+	stats = nullptr;
+}
+
+// largest number of bytes compress can produce from `n` bytes
+size_t huffcontext::compressBound(size_t n, const codetable_t* table)
+{
+	int maxbits = table ? tableMaxBits(*table) : this->maxbits;
+	uint8_t wide = symbolbits == 16 ? BLOCK_WIDE : 0;
+	size_t full = n / blocksize;
+	size_t bound = FRAME_HEADERSIZE
+	               + full * maxBlockSize(blocksize, maxbits, wide)
+	               + BLOCK_HEADERSIZE;
+
+	/* plus whatever's left over, in a shorter block */
+	if (n % blocksize)
+		bound += maxBlockSize(n % blocksize, maxbits, wide);
+
+	/* and an entry for each block and the end block */
+	if (indexed)
+		bound += indexSize(full + (n % blocksize != 0) + 1);
+
+	return bound;
+}
+
+// compresses `in` into `out` as a framed buffer, returns the number of bytes
+// written or -1 on failure
+long huffcontext::compress(const uint8_t* in, size_t inlen, uint8_t* out,
+                           size_t outlen, const codetable_t* table)
+{
+	size_t before = footprint();
+	long ret = compressBlocks(in, inlen, out, outlen, table);
+
+	if (footprint() != before)
+		grew++;
+	if (stats != nullptr and ret >= 0)
+	{
+		stats->add(COUNT_INPUT, inlen);
+		stats->add(COUNT_OUTPUT, ret);
+	}
+	return ret;
+}
+
+long huffcontext::compressBlocks(const uint8_t* in, size_t inlen, uint8_t* out,
+                                 size_t outlen, const codetable_t* table)
+{
+	size_t pos = FRAME_HEADERSIZE;
+	int maxbits = table ? tableMaxBits(*table) : this->maxbits;
+	blockhistory_t history;
+
+	if (maxbits < 1 or maxbits > 32 or blocksize < 1
+	    or blocksize > BLOCK_MAXSIZE or outlen < FRAME_HEADERSIZE)
+		return -1;
+
+	/* 16-bit symbols get a code of their own, laid out their own way */
+	bool wide = symbolbits == 16;
+	if ((symbolbits != 8 and not wide)
+	    or (wide and (table != nullptr or context or runs or flags != 0
+	                  or transforms != 0)))
+		return -1;
+
+	writeFrameHeader(out, indexed ? FRAME_INDEXED : 0);
+	index.clear();
+
+	for (size_t done = 0; done < inlen; )
+	{
+		size_t n = (inlen - done < blocksize) ? inlen - done : blocksize;
+		size_t worst = maxBlockSize(n, maxbits, wide ? BLOCK_WIDE : 0);
+		size_t used;
+		blockheader_t h;
+
+		/* a block may reuse the code of an earlier one, so they're chosen */
+		/* in order, with `history` starting afresh for each buffer. Blocks */
+		/* of 16-bit symbols are planned as they're encoded */
+		if (not wide)
+		{
+			if (table != nullptr)
+				planTable(plan, *table);
+			else
+			{
+				/* everything after the transforms plans their output */
+				const uint8_t* coded = planTransforms(in + done, n, transforms,
+				                                      plan, work, stats);
+				if (not planBlock(coded, n, maxbits, plan, work, stats))
+					return -1;
+				if (context)
+					planContext(coded, n, maxbits, plan, work, stats);
+				if (runs)
+					planRuns(coded, n, maxbits, plan, work, stats);
+				chooseBlock(plan, n, flags, history);
+			}
+		}
+
+		/* encode in place when there's room for the worst case, otherwise */
+		/* off to the side, in case it doesn't fit */
+		uint8_t* dest = out + pos;
+		if (outlen - pos < worst)
+		{
+			scratch.resize(worst);
+			dest = scratch.data();
+		}
+		if (wide)
+			used = encodeWideBlock(in + done, n, maxbits, dest, work, stats);
+		else
+			used = writeBlock(in + done, n, dest, flags, plan, stats);
+		if (dest != out + pos)
+		{
+			if (used > outlen - pos)
+				return -1;
+			memcpy(out + pos, scratch.data(), used);
+		}
+
+		/* the index takes what the block turned out to be from its header */
+		if (indexed and readBlockHeader(out + pos, h))
+			addIndexEntry(index, pos, done, h.type, h.table, h.flags);
+		pos += used;
+		done += n;
+	}
+
+	/* an empty end block marks the end */
+	if (outlen - pos < BLOCK_HEADERSIZE)
+		return -1;
+	blockheader_t end = {BLOCK_END, 0, TABLE_INLINE, 0, 0};
+	writeBlockHeader(out + pos, end);
+	if (not indexed)
+		return pos + BLOCK_HEADERSIZE;
+
+	/* then the index of every block, and the end block */
+	addIndexEntry(index, pos, inlen, BLOCK_END, TABLE_INLINE, 0);
+	pos += BLOCK_HEADERSIZE;
+	if (outlen - pos < indexSize(index.size()))
+		return -1;
+
+	return pos + writeIndex(index, out + pos);
+}
+
+// adds up the raw sizes of every block, returns -1 if a header is invalid
+long huffcontext::decompressedSize(const uint8_t* in, size_t inlen)
+{
+	size_t pos = FRAME_HEADERSIZE;
+	size_t total = 0;
+	blockheader_t h;
+
+	if (inlen < FRAME_HEADERSIZE or not readFrameHeader(in))
+		return -1;
+
+	for (;;)
+	{
+		if (inlen - pos < BLOCK_HEADERSIZE or not readBlockHeader(in + pos, h))
+			return -1;
+		pos += BLOCK_HEADERSIZE;
+
+		if (h.type == BLOCK_END)
+			return total;
+
+		if (inlen - pos < h.packsize)
+			return -1;
+		pos += h.packsize;
+		total += h.rawsize;
+	}
+}
+
+// decompresses `in` into `out` a block at a time, returns the number of bytes
+// written or -1 on failure
+long huffcontext::decompress(const uint8_t* in, size_t inlen, uint8_t* out,
+                             size_t outlen, const codetable_t* table)
+{
+	size_t before = footprint();
+	long ret = decompressBlocks(in, inlen, out, outlen, table);
+
+	if (footprint() != before)
+		grew++;
+	if (stats != nullptr and ret >= 0)
+	{
+		stats->add(COUNT_INPUT, inlen);
+		stats->add(COUNT_OUTPUT, ret);
+	}
+	return ret;
+}
+
+long huffcontext::decompressBlocks(const uint8_t* in, size_t inlen,
+                                   uint8_t* out, size_t outlen,
+                                   const codetable_t* table)
+{
+	size_t pos = FRAME_HEADERSIZE;
+	size_t done = 0;
+	uint8_t previous[256];
+	bool havePrevious = false;
+	blockheader_t h;
+
+	if (inlen < FRAME_HEADERSIZE or not readFrameHeader(in))
+		return -1;
+
+	for (;;)
+	{
+		if (inlen - pos < BLOCK_HEADERSIZE or not readBlockHeader(in + pos, h))
+			return -1;
+		pos += BLOCK_HEADERSIZE;
+
+		if (h.type == BLOCK_END)
+			return done;
+
+		if (inlen - pos < h.packsize or outlen - done < h.rawsize
+		    or not decodeBlock(h, in + pos, out + done, work, table,
+		                       havePrevious ? previous : nullptr, stats))
+			return -1;
+
+		/* later blocks may reuse this one's code */
+		if (storesTable(h))
+			havePrevious = readBlockLengths(h, in + pos, previous) != 0;
+
+		pos += h.packsize;
+		done += h.rawsize;
+	}
+}
+
+// decompresses the `len` bytes at `start` in the original of `in` into
+// `out`, a block at a time, returns the number of bytes written or -1 on
+// failure
+long huffcontext::decompressRange(const uint8_t* in, size_t inlen,
+                                  uint64_t start, uint8_t* out, size_t len,
+                                  const codetable_t* table)
+{
+	size_t before = footprint();
+	long ret = decompressBlocksIn(in, inlen, start, out, len, table);
+
+	if (footprint() != before)
+		grew++;
+	if (stats != nullptr and ret >= 0)
+	{
+		stats->add(COUNT_INPUT, inlen);
+		stats->add(COUNT_OUTPUT, ret);
+	}
+	return ret;
+}
+
+long huffcontext::decompressBlocksIn(const uint8_t* in, size_t inlen,
+                                     uint64_t start, uint8_t* out, size_t len,
+                                     const codetable_t* table)
+{
+	size_t done = 0;
+
+	if (not readIndex(in, inlen, index))
+		return -1;
+
+	/* the range ends early if the original does */
+	uint64_t total = index.back().rawoffset;
+	uint64_t end = (start < total and len < total - start) ? start + len
+	                                                        : total;
+
+	for (size_t b = findBlock(index, start); start + done < end; b++)
+	{
+		uint64_t blockstart = index[b].rawoffset;
+		size_t rawsize = index[b + 1].rawoffset - blockstart;
+		size_t skip = start + done - blockstart;
+		size_t take = (end - blockstart < rawsize ? end - blockstart : rawsize)
+		              - skip;
+
+		/* blocks wholly inside the range are decoded straight into place */
+		if (skip == 0 and take == rawsize)
+		{
+			if (not decodeIndexedBlock(in, index, b, out + done, work, table,
+			                           stats))
+				return -1;
+		}
+		else
+		{
+			scratch.resize(rawsize);
+			if (not decodeIndexedBlock(in, index, b, scratch.data(), work,
+			                           table, stats))
+				return -1;
+			memcpy(out + done, scratch.data() + skip, take);
+		}
+
+		done += take;
+	}
+
+	return done;
+}
+
+size_t huffcontext::growths()
+{
+	return grew;
+}
+
+void huffcontext::setMetrics(metrics* stats)
+{
+	this->stats = stats;
+}
+
+size_t huffcontext::footprint()
+{
+	size_t groups = 0;
+
+	for (int g = 0; g < CONTEXT_MAXGROUPS; g++)
+		groups += work.grouptables[g].entries.capacity() * sizeof(decodeentry_t)
+		          + work.grouptables[g].walks.capacity() * sizeof(node*);
+
+	return groups + scratch.capacity()
+	       + index.capacity() * sizeof(indexentry_t)
+	       + work.lengths.pool.capacity() * sizeof(pmitem_t)
+	       + work.lengths.leaves.capacity() * sizeof(int)
+	       + work.lengths.list.capacity() * sizeof(int)
+	       + work.lengths.merged.capacity() * sizeof(int)
+	       + work.lengths.weights.capacity() * sizeof(uint64_t)
+	       + work.lengths.symbols.capacity() * sizeof(uint16_t)
+	       + work.table.entries.capacity() * sizeof(decodeentry_t)
+	       + work.table.walks.capacity() * sizeof(node*)
+	       + work.arena.nodes.capacity() * sizeof(node)
+	       + work.pairs.capacity() * sizeof(uint32_t)
+	       + work.contexttable.entries.capacity() * sizeof(decodeentry_t)
+	       + work.widelengths.capacity()
+	       + work.widemap.capacity() * sizeof(huffcode_t)
+	       + work.widecodes.capacity() * sizeof(streamcode_t)
+	       + work.transformed.capacity()
+	       + work.transformwork.capacity() * sizeof(uint32_t)
+	       + plan.transformed.capacity();
+}
+
+
+long compress(const uint8_t* in, size_t inlen, uint8_t* out, size_t outlen)
+{
+	huffcontext ctx;
+
+	return ctx.compress(in, inlen, out, outlen);
+}
+
+long decompress(const uint8_t* in, size_t inlen, uint8_t* out, size_t outlen)
+{
+	huffcontext ctx;
+
+	return ctx.decompress(in, inlen, out, outlen);
+}
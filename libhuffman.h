@@ -0,0 +1,227 @@
+/// \file libhuffman.h
+/// \brief defines the in-memory compression interface of libhuffman
+///
+/// This file defines the entry points for programs which link libhuffman.a to
+/// compress and decompress buffers in memory, rather than files. Compressed
+/// buffers use the framed file format, so they can be written out and read
+/// back by the huffman program, and vice versa. Nothing here touches global
+/// state, so separate contexts can be used on separate threads at once.
+
+
+#ifndef LIBHUFFMAN_H
+#define LIBHUFFMAN_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "container.h"
+#include "huffcode.h"
+#include "metrics.h"
+#include "tables.h"
+
+/// \brief settings, tables and scratch space for compressing and decompressing
+///
+/// holds the settings used to compress, along with the tables and scratch
+/// buffers used along the way (code trees are built in an arena of
+/// ARENA_NODES nodes, grown once to ARENA_WIDENODES for blocks of 16-bit
+/// symbols). Keeping a context around between calls lets that memory be
+/// reused rather than allocated again every time: once a context has seen
+/// blocks as big as the ones it's given, compressing and decompressing
+/// allocate nothing at all. A context must only be used by one thread at a
+/// time.
+class huffcontext
+{
+public:
+	/// \brief constructor sets how buffers will be compressed
+	///
+	/// constructor sets how buffers will be compressed: the longest code
+	/// allowed (1 to 32 bits), the size of each block (1 to BLOCK_MAXSIZE
+	/// bytes), whether blocks are split into interleaved streams, whether
+	/// an index of the blocks is added (see decompressRange), whether
+	/// blocks may be coded with an order-1 context model (see context.h)
+	/// where that's smaller, and the bits in each symbol coded: 8 for bytes,
+	/// or 16 to code blocks as 16-bit little-endian symbols (see BLOCK_WIDE),
+	/// in which case the block size is rounded up to an even one, and
+	/// neither interleaving, a context model, runs, transforms nor a table
+	/// can be used. Then come whether blocks may be coded as runs (see
+	/// runs.h) where that's smaller, and the transforms (see
+	/// BLOCK_TRANSFORMS) every block is put through before it's coded, which
+	/// aren't used when compressing with a table
+	huffcontext(int maxbits = 15, size_t blocksize = BLOCK_DEFAULTSIZE,
+	            bool interleave = false, bool index = false,
+	            bool context = false, int symbolbits = 8, bool runs = false,
+	            uint8_t transforms = 0);
+
+	/// \brief largest compressed size of `n` bytes
+	///
+	/// largest number of bytes compress can produce from `n` bytes (with
+	/// `table`, if one will be used), so a buffer this big is always large
+	/// enough
+	size_t compressBound(size_t n, const codetable_t* table = nullptr);
+
+	/// \brief compresses the `inlen` bytes at `in` into `out`
+	///
+	/// compresses the `inlen` bytes at `in` into the `outlen` bytes at `out`.
+	/// If `table` is given (a built-in one from getStaticTable, or one loaded
+	/// with loadTable), every block is coded with it, which saves both the
+	/// code lengths and a pass over the input: worthwhile for small buffers
+	/// of the kind the table was made for. returns the number of bytes
+	/// written, or -1 if `out` is too small or the settings can't code the
+	/// input
+	long compress(const uint8_t* in, size_t inlen, uint8_t* out,
+	              size_t outlen, const codetable_t* table = nullptr);
+
+	/// \brief size of the data compressed in the `inlen` bytes at `in`
+	///
+	/// finds how many bytes the compressed data at `in` decompresses to,
+	/// from the block headers alone. returns -1 if they're invalid
+	long decompressedSize(const uint8_t* in, size_t inlen);
+
+	/// \brief decompresses the `inlen` bytes at `in` into `out`
+	///
+	/// decompresses the `inlen` bytes at `in` into the `outlen` bytes at
+	/// `out`. Built-in tables are always known, but data compressed with a
+	/// table loaded from a file needs the same table passed as `table`.
+	/// returns the number of bytes written, or -1 if the data is corrupt or
+	/// `out` is too small
+	long decompress(const uint8_t* in, size_t inlen, uint8_t* out,
+	                size_t outlen, const codetable_t* table = nullptr);
+
+	/// \brief decompresses part of the `inlen` bytes at `in` into `out`
+	///
+	/// decompresses the `len` bytes starting `start` bytes into the original
+	/// of the compressed data at `in` into `out`, decoding only the blocks
+	/// which hold them. With an index (see the constructor) the blocks are
+	/// found straight away; without one, every block header before them is
+	/// read, though none of the blocks are decoded. `table` is as for
+	/// decompress. returns the number of bytes written, which is less than
+	/// `len` if the range runs past the end of the original, or -1 if the
+	/// data is corrupt
+	long decompressRange(const uint8_t* in, size_t inlen, uint64_t start,
+	                     uint8_t* out, size_t len,
+	                     const codetable_t* table = nullptr);
+
+	/// \brief number of calls which had to grow the context's buffers
+	///
+	/// number of calls to compress or decompress after which the capacity of
+	/// the context's buffers (see footprint) had changed. It watches
+	/// capacities rather than counting heap allocations, so it only shows
+	/// the memory a call keeps; every buffer a call works in is one of these,
+	/// so in steady state (the same sort of input, over and over) it stops
+	/// going up, and so do allocations.
+	size_t growths();
+
+	/// \brief adds what later calls do to `stats`
+	///
+	/// adds the bytes, blocks and time taken by every later call to compress
+	/// or decompress to `stats`, or stops counting if it's nullptr (as it is
+	/// to begin with). One metrics object can be shared by contexts on
+	/// several threads at once, and must outlive its use here.
+	void setMetrics(metrics* stats);
+
+private:
+	/// \brief longest code allowed when compressing
+	///
+	/// longest code allowed when compressing, in bits
+	int maxbits;
+	/// \brief number of bytes in each block when compressing
+	///
+	/// number of bytes in each block when compressing
+	size_t blocksize;
+	/// \brief block flags used when compressing, see blockflag_t
+	///
+	/// block flags used when compressing, see blockflag_t
+	uint8_t flags;
+	/// \brief whether compressed buffers get an index
+	///
+	/// whether compressed buffers get an index of their blocks
+	bool indexed;
+	/// \brief whether blocks may be coded with a context model
+	///
+	/// whether blocks may be coded with an order-1 context model
+	bool context;
+	/// \brief bits in each symbol coded when compressing, 8 or 16
+	///
+	/// bits in each symbol coded when compressing, 8 or 16
+	int symbolbits;
+	/// \brief whether blocks may be coded as runs
+	///
+	/// whether blocks may be coded as runs of repeated bytes
+	bool runs;
+	/// \brief transforms every block goes through when compressing
+	///
+	/// transforms (see BLOCK_TRANSFORMS) every block goes through when
+	/// compressing without a table
+	uint8_t transforms;
+	/// \brief holds an encoded block when `out` might be too small for it
+	///
+	/// holds an encoded block which might not fit in what's left of `out`
+	std::vector<uint8_t> scratch;
+	/// \brief working memory for coding blocks
+	///
+	/// working memory for coding blocks: code length scratch, decode tables
+	/// and the node arena
+	blockscratch_t work;
+	/// \brief how the block being compressed is going to be coded
+	///
+	/// how the block being compressed is going to be coded, kept from call to
+	/// call along with its transformed bytes
+	blockplan_t plan;
+	/// \brief where each block is, while compressing or decompressing a range
+	///
+	/// where each block is, built up while compressing with an index, or read
+	/// from the compressed data to decompress a range
+	std::vector<indexentry_t> index;
+	/// \brief number of calls which had to grow the context's buffers
+	///
+	/// number of calls which had to grow the context's buffers, see
+	/// growths()
+	size_t grew;
+	/// \brief where calls are counted and timed, if anywhere
+	///
+	/// where calls are counted and timed, see setMetrics
+	metrics* stats;
+
+	/// \brief total size of every buffer the context owns
+	///
+	/// total size (capacity) of every buffer the context owns, in bytes. All
+	/// the memory a call works in is in these, so it changes when a call has
+	/// to allocate more.
+	size_t footprint();
+
+	/// \brief compresses `in` into `out`, see compress
+	///
+	/// does the work of compress
+	long compressBlocks(const uint8_t* in, size_t inlen, uint8_t* out,
+	                    size_t outlen, const codetable_t* table);
+
+	/// \brief decompresses `in` into `out`, see decompress
+	///
+	/// does the work of decompress
+	long decompressBlocks(const uint8_t* in, size_t inlen, uint8_t* out,
+	                      size_t outlen, const codetable_t* table);
+
+	/// \brief decompresses part of `in` into `out`, see decompressRange
+	///
+	/// does the work of decompressRange
+	long decompressBlocksIn(const uint8_t* in, size_t inlen, uint64_t start,
+	                        uint8_t* out, size_t len,
+	                        const codetable_t* table);
+};
+
+/// \brief compresses the `inlen` bytes at `in` into `out` with default settings
+///
+/// compresses the `inlen` bytes at `in` into the `outlen` bytes at `out`,
+/// using a fresh huffcontext with default settings. returns the number of
+/// bytes written, or -1 on failure
+long compress(const uint8_t* in, size_t inlen, uint8_t* out, size_t outlen);
+
+/// \brief decompresses the `inlen` bytes at `in` into `out`
+///
+/// decompresses the `inlen` bytes at `in` into the `outlen` bytes at `out`,
+/// using a fresh huffcontext. returns the number of bytes written, or -1 on
+/// failure
+long decompress(const uint8_t* in, size_t inlen, uint8_t* out, size_t outlen);
+
+#endif /* LIBHUFFMAN_H */
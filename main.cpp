@@ -1,54 +1,438 @@
 #include <iostream>
 #include <string>
 #include <iomanip>
-#include <fstream>
 #include <string> // argument parsing 
 #include <vector> // histogram sorting uses vector
 #include <algorithm> // sort
 #include <numeric> // iota
+#include <memory> // unique_ptr
+#include <thread> // hardware_concurrency
+#include <atomic> // atomic
+#include <functional> // function
+#include <new> // bad_alloc
+#include <unistd.h> // STDIN_FILENO
+#include <dirent.h> // opendir, readdir
+#include <sys/stat.h> // stat
 #include <cstdint> // uint32_t, uint8_t
-
+#include <cstdlib> // atoi, strtol, strtoull
+#include <cmath> // log2
+#include <fstream> // ofstream
+
+#include "canonical.h"
+#include "container.h"
+#include "fileio.h"
+#include "histogram.h"
 #include "huffcode.h"
+#include "metrics.h"
 #include "minheap.h"
 #include "node.h"
+#include "tables.h"
+#include "threadpool.h"
 #include "utf8.h"
-#include "stats.h"
 
 using namespace std;
 
-void encoderStats(uint32_t hist[256], huffcode_t huffmap[256]);
-void decoderStats();
-bool checkOpen (ifstream &fin, ofstream &fout);
+/* flag byte values at the start of an encoded file. legacy histogram */
+/* headers use 0 or 1 to say whether the 0-byte is in the histogram */
+#define HEADER_CANONICAL 2
+/* a static table's ID follows, and there is no header beyond that */
+#define HEADER_TABLE 3
+
+/* working memory for coding blocks, one per thread so that pool workers */
+/* keep theirs from one block to the next */
+static thread_local blockscratch_t blockScratch;
+
+/// \brief options which change how a file is encoded or decoded
+///
+/// options which change how a file is encoded or decoded, as given on the
+/// command line
+struct options
+{
+	/// \brief store canonical code lengths instead of the histogram
+	///
+	/// store canonical code lengths instead of the histogram
+	bool canonical = false;
+	/// \brief longest code allowed in canonical mode
+	///
+	/// longest code allowed in canonical mode, in bits
+	int maxbits = 15;
+	/// \brief size of the blocks in a framed file, or 0 for an unframed one
+	///
+	/// size of the blocks in a framed file, or 0 for an unframed one
+	size_t blocksize = 0;
+	/// \brief split each block's codes into interleaved streams
+	///
+	/// split each block's codes into INTERLEAVE_STREAMS interleaved streams,
+	/// which decode faster. implies a framed file
+	bool interleave = false;
+	/// \brief let blocks be coded with an order-1 context model
+	///
+	/// let each block be coded with codes chosen by the byte before (see
+	/// context.h) where that's smaller. implies a framed file
+	bool context = false;
+	/// \brief let blocks be coded as runs
+	///
+	/// let each block be coded as runs (see runs.h) where that's smaller.
+	/// implies a framed file
+	bool runs = false;
+	/// \brief bits in each symbol coded, 8 or 16
+	///
+	/// bits in each symbol coded: 8 for bytes, or 16 to code each block as
+	/// 16-bit little-endian symbols (see BLOCK_WIDE). 16 implies a framed file
+	int symbolbits = 8;
+	/// \brief transforms to put each block through before coding it
+	///
+	/// transforms (see BLOCK_TRANSFORMS) to put each block through before
+	/// coding it. any implies a framed file
+	uint8_t transforms = 0;
+	/// \brief number of threads to encode or decode blocks with
+	///
+	/// number of threads to encode or decode blocks with. More than one
+	/// implies a framed file when encoding.
+	size_t jobs = 1;
+	/// \brief add an index of the blocks to a framed file
+	///
+	/// add an index of the blocks to the end of a framed file, so that ranges
+	/// can be decoded from it without reading what comes before them
+	bool index = false;
+	/// \brief decode only a range of the original
+	///
+	/// decode only the `rangelen` bytes starting `rangestart` bytes into the
+	/// original, when decoding a framed file
+	bool ranged = false;
+	/// \brief where the range to decode starts
+	///
+	/// where the range to decode starts, in bytes of the original
+	uint64_t rangestart = 0;
+	/// \brief number of bytes in the range to decode
+	///
+	/// number of bytes in the range to decode
+	uint64_t rangelen = 0;
+	/// \brief static table to code with instead of building a code
+	///
+	/// static table to code with instead of building a code, when encoding.
+	/// When decoding, a table loaded from a file which the input may refer to
+	const codetable_t* table = nullptr;
+	/// \brief holds a table loaded from a file
+	///
+	/// holds a table loaded from a file, which `table` then points to
+	codetable_t usertable;
+	/// \brief ID given to a table made with --train
+	///
+	/// ID given to a table made with --train
+	uint8_t tableid = TABLE_USERMIN;
+	/// \brief where the run is counted and timed
+	///
+	/// where the bytes and blocks coded and the time spent in each phase are
+	/// added up
+	metrics* stats = nullptr;
+	/// \brief file to write the metrics to as JSON, if any
+	///
+	/// file to write the metrics to as JSON (- for stdout) instead of printing
+	/// statistics, or nullptr
+	const char* metricsfile = nullptr;
+};
+
+/// \brief a block of a framed file, along with its encoded form
+///
+/// a block of a framed file, along with its encoded form
+struct framedblock
+{
+	/// \brief the block's original bytes
+	///
+	/// the block's original bytes, within the mapped input file or `buf`
+	const uint8_t* in;
+	/// \brief number of bytes in the block
+	///
+	/// number of bytes in the block
+	size_t size;
+	/// \brief holds the block's bytes when they were read from a pipe
+	///
+	/// holds the block's bytes when they were read from a pipe
+	vector<uint8_t> buf;
+	/// \brief how the block is going to be coded
+	///
+	/// how the block is going to be coded
+	blockplan_t plan;
+	/// \brief whether a code could be found for the block
+	///
+	/// whether a code could be found for the block within the length limit
+	bool planned;
+	/// \brief the encoded block, header included
+	///
+	/// the encoded block, header included. empty if it couldn't be encoded
+	vector<uint8_t> out;
+};
+
+void encoderStats(const char* infile, const char* encodedfile,
+                  uint32_t hist[256], huffcode_t huffmap[256],
+                  const metrics& stats);
+void framedStats(const char* infile, const char* encodedfile,
+                 const metrics& stats);
+void tableStats(const char* infile, const char* encodedfile,
+                const codetable_t& table, const metrics& stats);
+void decoderStats(const char* encodedfile, const char* decodedfile,
+                  const metrics& stats);
+int writeMetrics(int error, const char* mode, const options& opts);
+bool checkOpen (mapfile &fin, outfile &fout);
 bool compareHistEntry(uint32_t* a, uint32_t* b);
-bool readHistogram(ifstream& f, uint32_t hist[256]);
-bool writeHistogram(ofstream& f, uint32_t hist[256]);
-int decode(char* encodedfile, char* outfile);
-int encode(char* infile, char* encodedfile);
+size_t readHistogram(const uint8_t* in, size_t n, uint32_t hist[256]);
+bool writeHistogram(outfile& f, uint32_t hist[256]);
+size_t readCodeLengths(const uint8_t* in, size_t n, uint8_t lengths[256]);
+bool writeCodeLengths(outfile& f, uint8_t lengths[256]);
+int decode(char* encodedfile, char* decodedfile, const options& opts);
+int decodeFramed(mapfile& fin, outfile& fout, size_t jobs,
+                 const codetable_t* user, metrics* stats);
+int decodeStream(int fd, outfile& fout, const codetable_t* user,
+                 metrics* stats);
+int decodeRange(mapfile& fin, outfile& fout, uint64_t start, uint64_t len,
+                const codetable_t* user, metrics* stats);
+bool checkTable(const blockheader_t& h, const codetable_t* user, size_t block);
+int encode(char* infile, char* encodedfile, const options& opts);
+int encodeStream(int fd, char* encodedfile, const options& opts);
+int encodeFramed(const function<bool(framedblock&)>& next, outfile& fout,
+                 const char* infile, const char* encodedfile,
+                 const options& opts);
+int train(char* samples, char* tablefile, const options& opts);
+bool countSamples(const string& path, uint64_t hist[256], size_t& files,
+                  uint64_t& bytes);
+size_t parseSize(const char* s);
+bool parseRange(const char* s, uint64_t& start, uint64_t& len);
+bool parseTransforms(const char* s, uint8_t& transforms);
 string huffcodeToString(huffcode_t c);
 
 
 static void usage()
 {
-	cerr << "Usage:\n\thuffman -e originalfile encodedfile"
-	        "\n\thuffman -d encodedfile decodedfile\n";
+	cerr << "Usage:\n\thuffman -e [-c] [--max-code-len N] [-b] [--block-size N]"
+	        " [--interleave]\n\t          [--context] [--runs] [--symbol-bits N]"
+	        " [-j N] [--table T]\n\t          [--transform LIST] [--index]"
+	        " [--metrics FILE] originalfile encodedfile"
+	        "\n\thuffman -d [-j N] [--table FILE] [--range START:LEN]"
+	        " [--metrics FILE]\n\t          encodedfile decodedfile"
+	        "\n\thuffman --train [--max-code-len N] [--table-id N] samples"
+	        " tablefile"
+	        "\n\nA file name of - reads from stdin or writes to stdout. Reading"
+	        " stdin implies -b."
+	        "\n\nOptions:"
+	        "\n\t-c                  store canonical code lengths instead of a"
+	        " histogram"
+	        "\n\t--max-code-len N    limit canonical codes to N bits (1 to 32,"
+	        " default 15),\n\t                    implies -c"
+	        "\n\t-b                  write a framed file of separately coded"
+	        " blocks"
+	        "\n\t--block-size N      size of each block, with an optional K, M"
+	        " or G suffix\n\t                    (default 1M), implies -b"
+	        "\n\t--interleave        split each block into 4 interleaved streams,"
+	        " which decode\n\t                    faster, implies -b"
+	        "\n\t--context           code blocks with codes chosen by the byte"
+	        " before where\n\t                    that's smaller, implies -b"
+	        "\n\t--runs              code blocks as runs of repeated bytes where"
+	        " that's smaller,\n\t                    implies -b"
+	        "\n\t--symbol-bits N     code blocks as N-bit symbols, 8 or 16"
+	        " (16-bit ones\n\t                    little-endian), implies -b"
+	        "\n\t--transform LIST    put each block through any of delta, bwt"
+	        " and mtf, in that\n\t                    order (comma-separated)"
+	        " before coding it, implies -b"
+	        "\n\t-j N                encode or decode blocks on N threads (0 for"
+	        " one per core),\n\t                    implies -b when encoding"
+	        "\n\t--table T           code with a static table instead of a"
+	        " header: english,\n\t                    json, logs, or a table"
+	        " file (which decoding needs too)"
+	        "\n\t--index             add an index of the blocks, for --range,"
+	        " implies -b"
+	        "\n\t--range START:LEN   decode only LEN bytes from START (each with"
+	        " an optional K,\n\t                    M or G suffix), from a"
+	        " framed file"
+	        "\n\t--train             make a table file from every file under"
+	        " samples (a file\n\t                    or directory)"
+	        "\n\t--table-id N        ID of the table made by --train (128 to"
+	        " 255, default 128)"
+	        "\n\t--metrics FILE      write byte and block counts and the time"
+	        " spent in each\n\t                    phase to FILE (- for stdout)"
+	        " as JSON, instead of printing\n\t                    statistics\n";
 }
 
 int main(int argc, char** argv)
 {
+	options opts;
+	metrics stats;
+	vector<char*> files;
+
+	opts.stats = &stats;
+
+	/* anything after the mode which isn't an option is a file name */
+	for (int i = 2; i < argc; i++)
+	{
+		string arg = argv[i];
+
+		if (arg == "-c")
+			opts.canonical = true;
+		else if (arg == "--max-code-len" and i + 1 < argc)
+		{
+			opts.canonical = true;
+			opts.maxbits = atoi(argv[++i]);
+			if (opts.maxbits < 1 or opts.maxbits > 32)
+			{
+				cerr << "E: --max-code-len must be between 1 and 32\n";
+				return (int)-1;
+			}
+		}
+		else if (arg == "--interleave")
+			opts.interleave = true;
+		else if (arg == "--context")
+			opts.context = true;
+		else if (arg == "--runs")
+			opts.runs = true;
+		else if (arg == "--symbol-bits" and i + 1 < argc)
+		{
+			opts.symbolbits = atoi(argv[++i]);
+			if (opts.symbolbits != 8 and opts.symbolbits != 16)
+			{
+				cerr << "E: --symbol-bits must be 8 or 16\n";
+				return (int)-1;
+			}
+		}
+		else if (arg == "--transform" and i + 1 < argc)
+		{
+			if (!parseTransforms(argv[++i], opts.transforms))
+			{
+				cerr << "E: --transform must be a comma-separated list of"
+				     << " delta, bwt and mtf, in that order\n";
+				return (int)-1;
+			}
+		}
+		else if (arg == "-b")
+		{
+			if (opts.blocksize == 0)
+				opts.blocksize = BLOCK_DEFAULTSIZE;
+		}
+		else if (arg == "-j" and i + 1 < argc)
+		{
+			char* end;
+			long jobs = strtol(argv[++i], &end, 10);
+			if (end == argv[i] or *end != '\0' or jobs < 0
+			    or jobs > THREADPOOL_MAXTHREADS)
+			{
+				cerr << "E: -j must be between 0 and " << THREADPOOL_MAXTHREADS
+				     << "\n";
+				return (int)-1;
+			}
+			opts.jobs = jobs;
+			if (opts.jobs == 0)
+				opts.jobs = std::thread::hardware_concurrency();
+			if (opts.jobs == 0)
+				opts.jobs = 1;
+		}
+		else if (arg == "--table" and i + 1 < argc)
+		{
+			const char* name = argv[++i];
+			opts.table = getStaticTable(name);
+			if (opts.table == nullptr)
+			{
+				if (!loadTable(name, opts.usertable))
+				{
+					cerr << "E: --table must be english, json, logs or a valid"
+					     << " table file\n";
+					return (int)-1;
+				}
+				opts.table = &opts.usertable;
+			}
+		}
+		else if (arg == "--table-id" and i + 1 < argc)
+		{
+			int id = atoi(argv[++i]);
+			if (id < TABLE_USERMIN or id > 255)
+			{
+				cerr << "E: --table-id must be between " << TABLE_USERMIN
+				     << " and 255\n";
+				return (int)-1;
+			}
+			opts.tableid = id;
+		}
+		else if (arg == "--metrics" and i + 1 < argc)
+			opts.metricsfile = argv[++i];
+		else if (arg == "--index")
+			opts.index = true;
+		else if (arg == "--range" and i + 1 < argc)
+		{
+			opts.ranged = true;
+			if (!parseRange(argv[++i], opts.rangestart, opts.rangelen))
+			{
+				cerr << "E: --range must be START:LEN, with LEN above 0\n";
+				return (int)-1;
+			}
+		}
+		else if (arg == "--block-size" and i + 1 < argc)
+		{
+			opts.blocksize = parseSize(argv[++i]);
+			if (opts.blocksize == 0 or opts.blocksize > BLOCK_MAXSIZE)
+			{
+				cerr << "E: --block-size must be between 1 and "
+				     << (BLOCK_MAXSIZE >> 20) << "M\n";
+				return (int)-1;
+			}
+		}
+		else if (arg.size() > 1 and arg[0] == '-')
+		{
+			cerr << "E: unknown option " << arg << "\n";
+			usage();
+			return (int)-1;
+		}
+		else
+			files.push_back(argv[i]);
+	}
+
+	/* more than one thread needs blocks to work on, interleaved streams */
+	/* and the index live inside blocks, and a pipe can't be read twice */
+	if ((opts.jobs > 1 or opts.interleave or opts.index or opts.context
+	     or opts.runs or opts.symbolbits != 8 or opts.transforms
+	     or (files.size() == 2 and string(files[0]) == "-"))
+	    and opts.blocksize == 0)
+		opts.blocksize = BLOCK_DEFAULTSIZE;
+
+	/* 16-bit symbols have a code of their own, and mustn't straddle blocks */
+	if (opts.symbolbits == 16)
+	{
+		if (opts.table or opts.context or opts.runs or opts.interleave
+		    or opts.transforms)
+		{
+			cerr << "E: --symbol-bits 16 can't be used with --table, --context,"
+			     << " --runs, --interleave or --transform\n";
+			return (int)-1;
+		}
+		opts.blocksize += opts.blocksize % 2;
+	}
+
+	/* a static table is made for bytes as they are */
+	if (opts.table and opts.transforms)
+	{
+		cerr << "E: --transform can't be used with --table\n";
+		return (int)-1;
+	}
+
+	/* the statistics mustn't end up mixed in with output to stdout */
+	if (files.size() == 2 and string(files[1]) == "-")
+		cout.rdbuf(cerr.rdbuf());
+
 	/* argument count checking */
-	if (argc != 4)
+	if (argc < 2 or files.size() != 2)
 	{
-		cerr << "E: " << argv[0] << " takes 3 args. " << (argc - 1)
+		cerr << "E: " << argv[0] << " takes 2 file names. " << files.size()
 		     << " found.\n";
 	}
 
 	/* handle decode */
 	else if (string("-d") == string(argv[1]))
-		return decode(argv[2], argv[3]);
+		return writeMetrics(decode(files[0], files[1], opts), "decode", opts);
 	
 	/* handle encode */
 	else if (string("-e") == string(argv[1]))
-		return encode(argv[2], argv[3]);
+		return writeMetrics(encode(files[0], files[1], opts), "encode", opts);
+
+	/* handle table training */
+	else if (string("--train") == string(argv[1]))
+		return train(files[0], files[1], opts);
 	
 	/* invalid flag or incorrect arg count */
 	usage();
@@ -74,7 +458,7 @@ int main(int argc, char** argv)
 
 //Check that the input and output files opened correctly
 // true = success, false = failure
-bool checkOpen (ifstream &fin, ofstream &fout)
+bool checkOpen (mapfile &fin, outfile &fout)
 {
 	//If files opened correctly, return true
 	if (fin.is_open() && fout.is_open())
@@ -96,27 +480,31 @@ bool compareHistEntry(uint32_t* a, uint32_t* b)
 }
 
 
-// Reads the histogram array from an open file, storing it
-// inside of the `hist` argument.
-// returns true on success, false otherwise
-bool readHistogram(ifstream& f, uint32_t hist[256])
+// Reads the histogram array from the `n` bytes at the start of a file,
+// storing it inside of the `hist` argument.
+// returns the number of bytes in the histogram, or 0 on failure
+size_t readHistogram(const uint8_t* in, size_t n, uint32_t hist[256])
 {
 	bool flag; /* indicates whether 0-byte is in histogram */
 	uint8_t character; 
 	uint8_t charcount;
+	size_t pos = 0;
 
-	f.seekg(0); /* always read histogram from the beginning */
-	if (!f) return false; /* don't bother trying if the file is invalid */
+	if (n == 0) return 0; /* don't bother trying if the file is empty */
 
-	f.get((char&)character); /* read flag byte */
-	flag = static_cast<bool>(character);
+	flag = static_cast<bool>(in[pos++]); /* read flag byte */
 
 	/* read first character histogram entry */
-	f.get((char&)character);
-	while (f and (flag or character))
+	while (pos < n)
 	{
+		character = in[pos++];
+		if (not (flag or character))
+			return pos;
+
 		/* read first byte of utf-8 encoded frequency count */
-		f.get((char&)charcount);
+		if (pos == n)
+			break;
+		charcount = in[pos++];
 
 		/* 1-byte code point - easy to handle */
 		if (charcount < 0x80)
@@ -138,9 +526,11 @@ bool readHistogram(ifstream& f, uint32_t hist[256])
 			}
 
 			/* read in the whole encoding from the file to utf8_t object */
+			if (n - pos < (size_t)codept.nbytes - 1)
+				break;
 			codept.encoded[0] = charcount;
 			for (int i = 1; i < codept.nbytes; i++)
-				f.get((char&)*(codept.encoded + i));
+				codept.encoded[i] = in[pos++];
 
 			hist[character] = getUInt(codept);
 		}
@@ -149,19 +539,16 @@ bool readHistogram(ifstream& f, uint32_t hist[256])
 		 * the next null byte will successfully indicate end of histogram */
 		if (character == 0)
 			flag = false;
-
-		/* try to get the next character */
-		f.get((char&)character);
 	}
 
-	/* return false if reading the histogram halted file i/o early */
-	return (bool)f;
+	/* the file ended before the histogram did */
+	return 0;
 }
 
 
 // Writes the histogram array to an open file
 // returns true on success, false otherwise
-bool writeHistogram(ofstream& f, uint32_t hist[256])
+bool writeHistogram(outfile& f, uint32_t hist[256])
 {
 		/* pointers to the histogram array */
 		vector<uint32_t*> freqs(256);
@@ -173,16 +560,13 @@ bool writeHistogram(ofstream& f, uint32_t hist[256])
 		while (**freqIter == 0 and ++freqIter != freqs.end())
 			continue;
 
-		f.seekp(0); /* always start at the beginning of a file */
-
 		/* if null-byte appears in histogram, set flag byte */
 		f.put(hist[0] ? 1 : 0);
 
 		/* write a byte indicating the character, and using32_t
          * indicating the number of times the character appears */
-		for (; freqIter != freqs.end() and f; freqIter++)
+		for (; freqIter != freqs.end() and f.good(); freqIter++)
 		{
-			eStats.numCodeWords++;
 			uint8_t character = static_cast<uint8_t>(*freqIter - hist);
 			uint32_t charcount = static_cast<uint32_t>(**freqIter);
 			utf8_t codept = getUTF8(charcount);
@@ -194,15 +578,59 @@ bool writeHistogram(ofstream& f, uint32_t hist[256])
 				return false;
 			}
 			
-			f.write((char*)&character, 1);
-			f.write((char*)codept.encoded, codept.nbytes);
+			f.put(character);
+			f.write(codept.encoded, codept.nbytes);
 		}
 
 		/* terminate the histogram section of the file */
 		f.put(0);
 
-		/* if the output is successful, f will still evaluate to true */
-		return (bool)f;
+		/* if the output is successful, f will still be good */
+		return f.good();
+}
+
+// Reads canonical code lengths from the `n` bytes at the start of a file,
+// storing them inside of the `lengths` argument.
+// returns the number of bytes in the header, or 0 on failure
+size_t readCodeLengths(const uint8_t* in, size_t n, uint8_t lengths[256])
+{
+	size_t used;
+
+	if (n == 0 or in[0] != HEADER_CANONICAL)
+		return 0;
+
+	/* the packed lengths say where they end */
+	used = unpackLengths(in + 1, n - 1, lengths, 256);
+	if (used == 0)
+	{
+		cerr << "Error: invalid code lengths in header\n";
+		return 0;
+	}
+
+	return 1 + used;
+}
+
+
+// Writes canonical code lengths to the start of an open file
+// returns true on success, false otherwise
+bool writeCodeLengths(outfile& f, uint8_t lengths[256])
+{
+	uint8_t packed[CANON_MAXHEADER];
+	size_t used;
+
+	/* flag byte says this isn't a histogram, then the packed lengths */
+	f.put(HEADER_CANONICAL);
+	used = packLengths(lengths, 256, packed);
+	f.write(packed, used);
+
+	/* if the output is successful, f will still be good */
+	return f.good();
+}
+
+// Compressed size as a percentage of the original size
+static double compressRatio(uint64_t packed, uint64_t raw)
+{
+	return 100.0 * packed / raw;
 }
 
 /***************************************************************************//**
@@ -212,33 +640,40 @@ bool writeHistogram(ofstream& f, uint32_t hist[256])
  * This function will print out the encoder statistics. The statistics consist
  * of name of input file and its size, the number of code words in the input
  * file, and will print out a table of all the code words with their probability,
- * values, and huff code. This will be done by updating the struct eStats when
- * the information is available throughout the program. In the table of code 
- * words, only printable code words will be printed.
+ * values, and huff code. The sizes are taken from the metrics counted while
+ * the file was encoded. In the table of code words, only printable code words
+ * will be printed.
  *
  * The statistics also consist of the number of encoded bytes, the file they 
  * will be saved to, the total number of bytes that will be written to the output
- * file, average bits per symbol, compression rate and entropy. These values
- * will also be retrieved by updating the struct eStats when the information
- * is available within the program.
+ * file, average bits per symbol, compression rate and entropy, which are
+ * worked out from the histogram and the metrics.
  * 
+ * @param[in] infile - Name of the input file
+ * @param[in] encodedfile - Name of the output file
  * @param[in] hist - Array that holds the histogram
  * @param[in] huffmap - Map that holds huff codes
+ * @param[in] stats - Metrics counted while encoding
  *
  * @returns none
  *
  ******************************************************************************/
 
-void encoderStats(uint32_t hist[256], huffcode_t huffmap[256])
+void encoderStats(const char* infile, const char* encodedfile,
+                  uint32_t hist[256], huffcode_t huffmap[256],
+                  const metrics& stats)
 {
+	uint64_t numBytes = stats.get(COUNT_INPUT);
 	uint32_t charFreq;
 	double probability = 0.0;
+	double entropy = 0.0;
+	double avgBit = 0.0;
 	huffcode_t huffCode;
 
-	//Print out encode statistics using eStats struct for encoder pass 1
+	//Print out encode statistics for encoder pass 1
 	cout << endl << "Huffman Encoder Pass 1" << endl << setfill ('-') << setw(22);
-        cout << "-" << endl << "Read " << eStats.numBytes << " from " << eStats.inputName;
-        cout <<", found " << eStats.numCodeWords << " code words" << endl << endl;
+        cout << "-" << endl << "Read " << numBytes << " from " << infile;
+        cout <<", found " << stats.get(COUNT_CODEWORDS) << " code words" << endl << endl;
         cout << "Huffman Code Table" << endl << setfill ('-') << setw(18) << "-";
 	cout << endl << "ASCII Code " << setfill (' ') << setw(25) << "Probablility (%) ";
 	cout << setw(23) << " Huffman Code" << endl;
@@ -251,7 +686,7 @@ void encoderStats(uint32_t hist[256], huffcode_t huffmap[256])
 			continue;
 
 		huffCode = huffmap[ch];	
-		probability = 100.0 * (double)charFreq / (double)eStats.numBytes;
+		probability = 100.0 * (double)charFreq / (double)numBytes;
 	
 		cout << right  << setw(3) <<  ch << "  ( ";	
 		
@@ -264,23 +699,70 @@ void encoderStats(uint32_t hist[256], huffcode_t huffmap[256])
 		cout << " )" << right <<  setw(20) << setprecision(2) << fixed << probability;
 		cout << right << setw(29) << huffcodeToString(huffCode) << endl;
 
-		//Call calcEntropy and calcAvg and sum them as for loop continues
-		eStats.entropy += calcEntropy(probability);
-		eStats.avgBit += calcAvg(probability, huffCode.bitcnt);
+		//Entropy is -SUM p log2 p, average bits is SUM p * code length
+		entropy -= probability / 100 * log2(probability / 100);
+		avgBit += probability / 100 * huffCode.bitcnt;
 	}
 
-	//Will calculate the compressed size and update struct 
-	calcCompress(eStats);
-
-	//Print out encoder stats using eStats struct for encoder pass 2
+	//Print out encoder stats for encoder pass 2
 	cout << endl << "Huffman Encoder Pass 2" << endl << setfill ('-') << setw(22) << "-";
-	cout << endl <<  "Wrote " << eStats.numEBytes << " encoded bytes to " << eStats.outputName << " (";
-	cout << eStats.numOverhead << " bytes including histogram)" << endl << endl;
+	cout << endl <<  "Wrote " << stats.get(COUNT_PAYLOAD) << " encoded bytes to " << encodedfile << " (";
+	cout << stats.get(COUNT_OUTPUT) << " bytes including histogram)" << endl << endl;
 
 	cout << endl << "Huffman Coding Statistics" << endl << setfill ('-') << setw(25);
 	cout << "-" << endl << "Compression ratio = " << fixed << setprecision(2);
-	cout << eStats.compressRatio << "% " << endl << "Entropy = " << eStats.entropy << endl; 
-	cout << "Average bits per symbol in Huffman coding = " << eStats.avgBit << endl;
+	cout << compressRatio(stats.get(COUNT_PAYLOAD), numBytes) << "% " << endl;
+	cout << "Entropy = " << entropy << endl; 
+	cout << "Average bits per symbol in Huffman coding = " << avgBit << endl;
+
+	return;
+}
+
+// Prints out the encoder statistics for a framed file. Each block has its own
+// code table, so unlike encoderStats there is no single table to show, just
+// how many blocks got a table of their own, reused an earlier block's or a
+// static table, got a context model of their own, were coded as runs, or were
+// stored raw, and how many were transformed first.
+void framedStats(const char* infile, const char* encodedfile,
+                 const metrics& stats)
+{
+	cout << endl << "Huffman Block Encoder" << endl << setfill ('-') << setw(21);
+	cout << "-" << endl << "Read " << stats.get(COUNT_INPUT) << " from " << infile;
+	cout << endl << "Wrote " << stats.get(COUNT_BLOCKS) << " blocks (";
+	cout << stats.get(COUNT_PAYLOAD) << " bytes of tables and codes) to ";
+	cout << encodedfile << " (" << stats.get(COUNT_OUTPUT);
+	cout << " bytes including headers)" << endl;
+	cout << stats.get(COUNT_BLOCKS_NEW) << " with a new table, ";
+	cout << stats.get(COUNT_BLOCKS_REUSED) << " reusing a known one, ";
+	if (stats.get(COUNT_BLOCKS_CONTEXT))
+		cout << stats.get(COUNT_BLOCKS_CONTEXT) << " with a context model, ";
+	if (stats.get(COUNT_BLOCKS_RUNS))
+		cout << stats.get(COUNT_BLOCKS_RUNS) << " coded as runs, ";
+	cout << stats.get(COUNT_BLOCKS_RAW) << " stored raw" << endl;
+	if (stats.get(COUNT_TRANSFORMED))
+		cout << stats.get(COUNT_TRANSFORMED) << " coded after transforms"
+		     << endl;
+	cout << "Compression ratio = " << fixed << setprecision(2);
+	cout << compressRatio(stats.get(COUNT_PAYLOAD), stats.get(COUNT_INPUT));
+	cout << "% " << endl;
+
+	return;
+}
+
+// Prints out the encoder statistics for a file coded with a static table.
+// The table was fixed in advance, so there is no histogram to show.
+void tableStats(const char* infile, const char* encodedfile,
+                const codetable_t& table, const metrics& stats)
+{
+	cout << endl << "Huffman Table Encoder" << endl << setfill ('-') << setw(21);
+	cout << "-" << endl << "Read " << stats.get(COUNT_INPUT) << " from " << infile;
+	cout << endl << "Wrote " << stats.get(COUNT_PAYLOAD) << " encoded bytes with table ";
+	cout << (table.name ? table.name : to_string(table.id)) << " to ";
+	cout << encodedfile << " (" << stats.get(COUNT_OUTPUT);
+	cout << " bytes including header)" << endl;
+	cout << "Compression ratio = " << fixed << setprecision(2);
+	cout << compressRatio(stats.get(COUNT_PAYLOAD), stats.get(COUNT_INPUT));
+	cout << "% " << endl;
 
 	return;
 }
@@ -294,72 +776,166 @@ void encoderStats(uint32_t hist[256], huffcode_t huffmap[256])
  * file, the number of decoded bytes written to an output file, and the 
  * compression ratio.
  *
+ * @param[in] encodedfile - Name of the input file
+ * @param[in] decodedfile - Name of the output file
+ * @param[in] stats - Metrics counted while decoding
+ *
  * @returns none
  *
  ******************************************************************************/
 
-void decoderStats()
+void decoderStats(const char* encodedfile, const char* decodedfile,
+                  const metrics& stats)
 {
-	//Will calculate the compressed size
-	calcCompress(dStats);
-	
-	//Print out decoder stats using dStats struct
+	//Print out decoder stats
 	cout << endl << "Huffman Coding Statistics" << endl << setfill ('-') << setw(22);
-	cout << "-" << endl << "Read " << dStats.numEBytes << " encoded bytes from " << dStats.inputName;
-	cout << " (" << dStats.numOverhead << " bytes including the histogram)" << endl << "Wrote ";
-	cout << dStats.numBytes << " decoded bytes to " << dStats.outputName << endl << "Compression";
-	cout << " ratio: " << fixed << setprecision(2) << dStats.compressRatio << "%" <<  endl;
+	cout << "-" << endl << "Read " << stats.get(COUNT_PAYLOAD) << " encoded bytes from " << encodedfile;
+	cout << " (" << stats.get(COUNT_INPUT) << " bytes including the histogram)" << endl << "Wrote ";
+	cout << stats.get(COUNT_OUTPUT) << " decoded bytes to " << decodedfile << endl << "Compression";
+	cout << " ratio: " << fixed << setprecision(2);
+	cout << compressRatio(stats.get(COUNT_PAYLOAD), stats.get(COUNT_OUTPUT)) << "%" <<  endl;
 	
 	return;
 }
 
-int encode(char* infile, char* encodedfile)
+// Writes the metrics of the run which just finished with `error` to the file
+// given with --metrics, if any, as JSON along with the mode and the error.
+// returns `error`, or 8 if there was none but the metrics couldn't be written
+int writeMetrics(int error, const char* mode, const options& opts)
 {
-	ifstream fin;
-	ofstream fout;
+	if (opts.metricsfile == nullptr)
+		return error;
+
+	ofstream file;
+	bool toStdout = string(opts.metricsfile) == "-";
+	if (!toStdout)
+		file.open(opts.metricsfile);
+	ostream& out = toStdout ? cout : file;
+
+	out << "{\"mode\": \"" << mode << "\", \"status\": " << error
+	    << ", \"metrics\": " << opts.stats->json() << "}" << endl;
+
+	if (!out.good())
+	{
+		cerr << "Error encountered while writing metrics to "
+		     << opts.metricsfile << "\n";
+		return error ? error : 8;
+	}
+
+	return error;
+}
+
+int encode(char* infile, char* encodedfile, const options& opts)
+{
+	/* pipes are read a block at a time, straight into the framed encoder */
+	if (string(infile) == "-")
+		return encodeStream(STDIN_FILENO, encodedfile, opts);
+
+	mapfile fin;
+	outfile fout;
 	bool filesOpen = false;
 	uint32_t histogram[256] = {0};
 	node* tree;
 	huffcode_t map[256] = {0};
 	int error = 0;
 
-	//Open og file and encoded file in binary and check open
-	fin.open(infile, ios::in | ios::binary);
-	fout.open(encodedfile, ios::out | ios::binary | ios::trunc);
+	//Open og file and encoded file and check open
+	fin.open(infile);
+	fout.open(encodedfile);
 
 	filesOpen = checkOpen(fin, fout);
 	if (!filesOpen)
 		return 1;
 
-	//Save input and output file names into eStats struct
-	eStats.inputName = infile;
-	eStats.outputName = encodedfile;
-
 	//Find number of bytes in file
-	fin.seekg(0, fin.end);
-	eStats.numBytes = fin.tellg();
-	fin.seekg(0, fin.beg);
+	opts.stats->add(COUNT_INPUT, fin.size());
 
-	/** PASS 1 - BUILD HISTOGRAM AND CODE MAP **/
-	/* read a character at a time, populating histogram */
-	uint8_t character;
-	fin.get((char&)character);
-	while (fin.gcount() > 0)
+	if (opts.blocksize)
 	{
-		histogram[character]++;
-		fin.get((char&)character);
+		/* blocks are just spans of the mapped file */
+		size_t pos = 0;
+		auto next = [&](framedblock& b)
+		{
+			b.in = fin.data() + pos;
+			b.size = min(opts.blocksize, fin.size() - pos);
+			pos += b.size;
+			return b.size > 0;
+		};
+
+		return encodeFramed(next, fout, infile, encodedfile, opts);
 	}
 
-	/* if ending for non-eof reasons, badness occurred :( */
-	if (!fin.eof())
+	const uint8_t* in = fin.data();
+
+	/* a static table needs neither a first pass nor anything but its ID */
+	if (opts.table)
+	{
+		phasetimer building(opts.stats, PHASE_TREE);
+		getCanonicalMap(map, opts.table->lengths, 256);
+		building.stop();
+
+		fout.put(HEADER_TABLE);
+		fout.put(opts.table->id);
+		phasetimer encoding(opts.stats, PHASE_ENCODE);
+		writeHuffman(map, in, fin.size(), fout);
+		encoding.stop();
+
+		opts.stats->add(COUNT_PAYLOAD, fout.size() - 2);
+		opts.stats->add(COUNT_OUTPUT, fout.size());
+
+		phasetimer writing(opts.stats, PHASE_WRITE);
+		bool wrote = fout.good();
+		if (!fout.close())
+		{
+			if (wrote)
+				cerr << "Error encountered while writing encoded data to outfile.\n";
+			error += 8;
+		}
+		writing.stop();
+
+		if (opts.metricsfile == nullptr)
+			tableStats(infile, encodedfile, *opts.table, *opts.stats);
+
+		return error;
+	}
+
+	/** PASS 1 - BUILD HISTOGRAM AND CODE MAP **/
+	/* run over the mapped file, populating histogram */
+	phasetimer counting(opts.stats, PHASE_HISTOGRAM);
+	countBytes(histogram, in, fin.size());
+	counting.stop();
+
+	phasetimer building(opts.stats, PHASE_TREE);
+	tree = getTreeFromHist(histogram);
+
+	getHuffMapFromTree(map, tree);
+
+	/* canonical codes only need the (length-limited) length of each code */
+	bool writeHistSuccess;
+	if (opts.canonical)
+	{
+		uint8_t lengths[256];
+		if (!getLimitedLengths(lengths, histogram, 256, opts.maxbits))
+		{
+			cerr << "Error: " << opts.maxbits << "-bit codes are too short for "
+			     << "every byte in the file\n";
+			return 4;
+		}
+		getCanonicalMap(map, lengths, 256);
+		building.stop();
+		writeHistSuccess = writeCodeLengths(fout, lengths);
+	}
+	else
 	{
-		cerr << "Warning: input file read finished prematurely.\n";
-		error += 2;
+		building.stop();
+		writeHistSuccess = writeHistogram(fout, histogram);
 	}
 
-	bool writeHistSuccess = writeHistogram(fout, histogram);
+	/* either header describes a code word for every byte in the file */
+	for (int i = 0; i < 256; i++)
+		opts.stats->add(COUNT_CODEWORDS, histogram[i] != 0);
 
-	auto histogramPosition = fout.tellp();
+	auto histogramPosition = fout.size();
 
 	if (!writeHistSuccess)
 	{
@@ -367,78 +943,894 @@ int encode(char* infile, char* encodedfile)
 		cerr << "Warning: output histogram failed.\n";
 	}
 
-	tree = getTreeFromHist(histogram);
-
-	getHuffMapFromTree(map, tree);
-
 	/** PASS 2: ELECTRIC BOOGALOO **/
-	/* with the map made, read fin again and write the rest of the outfile */
-	writeHuffman(map, fin, fout);
+	/* with the map made, run over fin again and write the rest of the outfile */
+	phasetimer encoding(opts.stats, PHASE_ENCODE);
+	writeHuffman(map, in, fin.size(), fout);
+	encoding.stop();
 
 	//Find number of bytes including histogram written to file
-	fout.seekp(0, fout.end);
-	eStats.numEBytes = fout.tellp() - histogramPosition;
-	eStats.numOverhead = fout.tellp();
-	fout.seekp(0, fin.beg);
+	opts.stats->add(COUNT_PAYLOAD, fout.size() - histogramPosition);
+	opts.stats->add(COUNT_OUTPUT, fout.size());
+
+	/* writeHuffman has already complained if fout went bad */
+	phasetimer writing(opts.stats, PHASE_WRITE);
+	bool wrote = fout.good();
+	if (!fout.close())
+	{
+		if (wrote)
+			cerr << "Error encountered while writing encoded data to outfile.\n";
+		error += 8;
+	}
+	writing.stop();
 
-	encoderStats(histogram, map);
+	if (opts.metricsfile == nullptr)
+		encoderStats(infile, encodedfile, histogram, map, *opts.stats);
 
 	return error;
 }
 
 
-int decode(char* encodedfile, char* outfile)
+int decode(char* encodedfile, char* decodedfile, const options& opts)
 {
-	ifstream fin;
-	ofstream fout;
+	mapfile fin;
+	outfile fout;
 	bool filesOpen = false;
 	uint32_t histogram[256] = {0};
 	node* tree;
+	size_t headersize;
 
-	//Open encoded file and decoded file in binary and check open
-	fin.open(encodedfile, ios::in | ios::binary);
-	fout.open(outfile, ios::out | ios::binary | ios::trunc);
+	/* a range is found by seeking, which a pipe can't do */
+	if (opts.ranged and string(encodedfile) == "-")
+	{
+		cerr << "Error: --range can't read from a pipe\n";
+		return 5;
+	}
+
+	/* pipes can't be mapped, so framed files are streamed through instead */
+	if (string(encodedfile) == "-")
+	{
+		if (!fout.open(decodedfile))
+		{
+			cout << "Could not open file. Exiting program" << endl;
+			return 5;
+		}
+
+		int error = decodeStream(STDIN_FILENO, fout, opts.table, opts.stats);
+
+		opts.stats->add(COUNT_OUTPUT, fout.size());
+		phasetimer writing(opts.stats, PHASE_WRITE);
+		if (!fout.close() and error == 0)
+		{
+			cerr << "Error encountered while writing decoded data to outfile.\n";
+			error = 8;
+		}
+		writing.stop();
+
+		if (opts.metricsfile == nullptr)
+			decoderStats("stdin", decodedfile, *opts.stats);
+		return error;
+	}
+
+	//Open encoded file and decoded file and check open. blocks decoded on
+	//several threads are read out of order, so need all of fin at once
+	fin.open(encodedfile, opts.jobs <= 1 or opts.ranged);
+	fout.open(decodedfile);
 
 	filesOpen = checkOpen(fin, fout);
 	if (!filesOpen)
 		return 5;
+
+	/* a range needs only a few blocks, wherever they are */
+	if (opts.ranged)
+		fin.randomAccess();
 	
-	//Save input and output file names into dStats struct
-	dStats.inputName = encodedfile;
-	dStats.outputName = outfile;
+	const uint8_t* in = fin.data();
+	size_t n = fin.size();
+
+	opts.stats->add(COUNT_INPUT, n);
+
+	/* framed files start with a magic number rather than a flag byte */
+	if (n > 0 and in[0] == FRAME_MAGIC[0])
+	{
+		int error = opts.ranged
+		            ? decodeRange(fin, fout, opts.rangestart, opts.rangelen,
+		                          opts.table, opts.stats)
+		            : decodeFramed(fin, fout, opts.jobs, opts.table,
+		                           opts.stats);
+
+		opts.stats->add(COUNT_OUTPUT, fout.size());
+		phasetimer writing(opts.stats, PHASE_WRITE);
+		if (!fout.close() and error == 0)
+		{
+			cerr << "Error encountered while writing decoded data to outfile.\n";
+			error = 8;
+		}
+		writing.stop();
 
+		if (opts.metricsfile == nullptr)
+			decoderStats(encodedfile, decodedfile, *opts.stats);
+		return error;
+	}
 
-	if (!readHistogram(fin, histogram))
+	/* unframed files have nothing to say where any byte's code is */
+	if (opts.ranged)
 	{
-		fin.close();
-		fout.close();
+		cerr << "Error: --range needs a framed file\n";
 		return 6;
 	}
 
-	auto histogramPosition = fin.tellg();
+	/* canonical headers carry code lengths, anything else is a histogram */
+	phasetimer building(opts.stats, PHASE_TREE);
+	if (n > 0 and in[0] == HEADER_CANONICAL)
+	{
+		uint8_t lengths[256];
+		huffcode_t map[256];
+
+		headersize = readCodeLengths(in, n, lengths);
+		if (headersize == 0)
+			return 6;
+		for (int i = 0; i < 256; i++)
+			opts.stats->add(COUNT_CODEWORDS, lengths[i] != 0);
+
+		getCanonicalMap(map, lengths, 256);
+		tree = getTreeFromMap(map, 256);
+	}
+	else if (n > 0 and in[0] == HEADER_TABLE)
+	{
+		huffcode_t map[256];
+		const codetable_t* table = (n > 1) ? findTable(in[1], opts.table)
+		                                   : nullptr;
+
+		if (table == nullptr)
+		{
+			if (n > 1)
+				cerr << "Error: encoded with unknown table " << (int)in[1]
+				     << " (pass its table file with --table)\n";
+			else
+				cerr << "Error: truncated header\n";
+			return 6;
+		}
+		headersize = 2;
+
+		getCanonicalMap(map, table->lengths, 256);
+		tree = getTreeFromMap(map, 256);
+	}
+	else
+	{
+		headersize = readHistogram(in, n, histogram);
+		if (headersize == 0)
+			return 6;
+		for (int i = 0; i < 256; i++)
+			opts.stats->add(COUNT_CODEWORDS, histogram[i] != 0);
+
+		tree = getTreeFromHist(histogram);
+	}
+
+	building.stop();
+
+	/* the codes run from the end of the header to the end of the file */
+	phasetimer decoding(opts.stats, PHASE_DECODE);
+	readHuffman(tree, in + headersize, n - headersize, fout);
+	decoding.stop();
+
+	//Find number of bytes written, and in file (and excluding histogram)
+	opts.stats->add(COUNT_OUTPUT, fout.size());
+	opts.stats->add(COUNT_PAYLOAD, n - headersize);
+
+	phasetimer writing(opts.stats, PHASE_WRITE);
+	if (!fout.close())
+	{
+		cerr << "Error encountered while writing decoded data to outfile.\n";
+		return 8;
+	}
+	writing.stop();
+
+	if (opts.metricsfile == nullptr)
+		decoderStats(encodedfile, decodedfile, *opts.stats);
+	return 0;
+}
+
+
+// Encodes the blocks handed out by `next` into fout as a framed file. Each
+// block is coded with its own length-limited canonical code, the last one
+// stored before it, or stored raw, whichever is smallest. With more than one
+// job, blocks are counted and encoded a batch at a time on a thread pool
+// (with the choices made in order in between) and then written out in order.
+// With 16-bit symbols, every block is coded as a BLOCK_WIDE block (or raw).
+// returns 0 on success, or an error code like encode's
+int encodeFramed(const function<bool(framedblock&)>& next, outfile& fout,
+                 const char* infile, const char* encodedfile,
+                 const options& opts)
+{
+	/* a few blocks per thread, so that stealing can even out the work */
+	size_t batchsize = opts.jobs > 1 ? opts.jobs * 4 : 1;
+	vector<framedblock> batch(batchsize);
+	std::unique_ptr<threadpool> pool;
+	uint8_t header[BLOCK_HEADERSIZE];
+	size_t blocks = 0;
+	size_t count = batchsize;
+	blockhistory_t history;
+	int error = 0;
+	/* a static table sets its own limit on how long a code can be */
+	int maxbits = opts.table ? tableMaxBits(*opts.table) : opts.maxbits;
+	uint8_t flags = opts.interleave ? BLOCK_INTERLEAVED : 0;
+
+	if (opts.jobs > 1)
+		pool.reset(new threadpool(opts.jobs));
+
+	vector<indexentry_t> index;
+	uint64_t rawoffset = 0;
+
+	writeFrameHeader(header, opts.index ? FRAME_INDEXED : 0);
+	fout.write(header, FRAME_HEADERSIZE);
+
+	/* a short batch means `next` has run out */
+	while (count == batchsize and fout.good())
+	{
+		for (count = 0; count < batchsize and next(batch[count]); count++)
+			continue;
+
+		/* count the bytes of every block in the batch, and find its code */
+		for (size_t i = 0; i < count; i++)
+		{
+			framedblock* b = &batch[i];
+			auto task = [b, &opts]
+			{
+				b->planned = true;
+				if (opts.symbolbits == 16)
+					return;
+				if (opts.table)
+				{
+					planTable(b->plan, *opts.table);
+					return;
+				}
+
+				/* everything after the transforms plans their output */
+				const uint8_t* in = planTransforms(b->in, b->size,
+				                                   opts.transforms, b->plan,
+				                                   blockScratch, opts.stats);
+				b->planned = planBlock(in, b->size, opts.maxbits, b->plan,
+				                       blockScratch, opts.stats);
+				if (b->planned and opts.context)
+					planContext(in, b->size, opts.maxbits, b->plan,
+					            blockScratch, opts.stats);
+				if (b->planned and opts.runs)
+					planRuns(in, b->size, opts.maxbits, b->plan, blockScratch,
+					         opts.stats);
+			};
+
+			if (pool)
+				pool->submit(task);
+			else
+				task();
+		}
+
+		if (pool)
+			pool->wait();
+
+		/* whether a block can reuse a table depends on the blocks before */
+		/* it, so the choice is made one block at a time, in order */
+		for (size_t i = 0; i < count; i++)
+		{
+			if (!batch[i].planned)
+			{
+				cerr << "Error: " << opts.maxbits << "-bit codes are too short "
+				     << "for every byte in block " << blocks + i << "\n";
+				return 4;
+			}
+			if (!opts.table and opts.symbolbits == 8)
+				chooseBlock(batch[i].plan, batch[i].size, flags, history);
+		}
+
+		/* then encode every block in the batch as chosen */
+		for (size_t i = 0; i < count; i++)
+		{
+			framedblock* b = &batch[i];
+			auto task = [b, flags, maxbits, &opts]
+			{
+				if (opts.symbolbits == 16)
+				{
+					b->out.resize(maxBlockSize(b->size, maxbits, BLOCK_WIDE));
+					b->out.resize(encodeWideBlock(b->in, b->size, maxbits,
+					                              b->out.data(), blockScratch,
+					                              opts.stats));
+					return;
+				}
+				b->out.resize(maxBlockSize(b->size, maxbits));
+				b->out.resize(writeBlock(b->in, b->size, b->out.data(), flags,
+				                         b->plan, opts.stats));
+			};
+
+			if (pool)
+				pool->submit(task);
+			else
+				task();
+		}
+
+		if (pool)
+			pool->wait();
+
+		/* and write them out in order */
+		phasetimer writing(opts.stats, PHASE_WRITE);
+		for (size_t i = 0; i < count; i++, blocks++)
+		{
+			/* the index takes what each block turned out to be from its */
+			/* header, whichever way it was coded */
+			blockheader_t h;
+			if (opts.index and readBlockHeader(batch[i].out.data(), h))
+				addIndexEntry(index, fout.size(), rawoffset, h.type, h.table,
+				              h.flags);
+			rawoffset += batch[i].size;
+			fout.write(batch[i].out.data(), batch[i].out.size());
+		}
+	}
+
+	/* an empty end block marks the end of the file */
+	blockheader_t end = {BLOCK_END, 0, TABLE_INLINE, 0, 0};
+	writeBlockHeader(header, end);
+	if (opts.index)
+		addIndexEntry(index, fout.size(), rawoffset, BLOCK_END, TABLE_INLINE,
+		              0);
+	fout.write(header, BLOCK_HEADERSIZE);
+
+	/* followed by the index, if there is one */
+	if (opts.index)
+	{
+		vector<uint8_t> out(indexSize(index.size()));
+		writeIndex(index, out.data());
+		fout.write(out.data(), out.size());
+	}
+
+	opts.stats->add(COUNT_OUTPUT, fout.size());
+	phasetimer writing(opts.stats, PHASE_WRITE);
+	if (!fout.close())
+	{
+		cerr << "Error encountered while writing encoded data to outfile.\n";
+		error += 8;
+	}
+	writing.stop();
+
+	if (opts.metricsfile == nullptr)
+		framedStats(infile, encodedfile, *opts.stats);
+
+	return error;
+}
+
+
+// Encodes whatever can be read from `fd` (typically a pipe) into the file
+// `encodedfile` as a framed file, reading one block at a time into the batch
+// so that no more than a batch of blocks is ever held in memory.
+// returns 0 on success, or an error code like encode's
+int encodeStream(int fd, char* encodedfile, const options& opts)
+{
+	outfile fout;
+	int error = 0;
+
+	if (!fout.open(encodedfile))
+	{
+		cout << "Could not open file. Exiting program" << endl;
+		return 1;
+	}
+
+	auto next = [&](framedblock& b)
+	{
+		phasetimer reading(opts.stats, PHASE_READ);
+		b.buf.resize(opts.blocksize);
+		long got = readAll(fd, b.buf.data(), opts.blocksize);
+
+		/* if ending for non-eof reasons, badness occurred :( */
+		if (got < 0)
+		{
+			cerr << "Warning: input file read finished prematurely.\n";
+			error = 2;
+			got = 0;
+		}
+
+		b.in = b.buf.data();
+		b.size = got;
+		opts.stats->add(COUNT_INPUT, got);
+		return got > 0;
+	};
+
+	return encodeFramed(next, fout, "stdin", encodedfile, opts) + error;
+}
+
+
+// Decodes the framed file fin into fout. The block headers are scanned first
+// to find where each block's payload is, where its bytes belong in the
+// output, and which block holds the code of any block reusing one. The
+// output is then sized up front and mapped. Each block is decoded straight
+// from fin into its place in the output, on `jobs` threads if there's more
+// than one.
+// returns 0 on success, or an error code like decode's
+int decodeFramed(mapfile& fin, outfile& fout, size_t jobs,
+                 const codetable_t* user, metrics* stats)
+{
+	/* where a block's payload is, where its bytes go, and which block has */
+	/* the code lengths it reuses */
+	struct blockpos { blockheader_t h; size_t in; size_t out; size_t table; };
+	vector<blockpos> blocks;
+	const uint8_t* in = fin.data();
+	size_t n = fin.size();
+	size_t inpos = FRAME_HEADERSIZE;
+	size_t outpos = 0;
+	size_t lastTable = SIZE_MAX;
+	blockheader_t h;
+
+	if (n < FRAME_HEADERSIZE or !readFrameHeader(in))
+	{
+		cerr << "Error: unsupported framed file\n";
+		return 6;
+	}
+
+	/* skip from header to header, laying out the output as we go */
+	for (;;)
+	{
+		if (n - inpos < BLOCK_HEADERSIZE or !readBlockHeader(in + inpos, h))
+		{
+			cerr << "Error: invalid header for block " << blocks.size() << "\n";
+			return 7;
+		}
+
+		if (h.type == BLOCK_END)
+			break;
+
+		inpos += BLOCK_HEADERSIZE;
+		if (n - inpos < h.packsize)
+		{
+			cerr << "Error: block " << blocks.size() << " is corrupt\n";
+			return 7;
+		}
+		if (!checkTable(h, user, blocks.size()))
+			return 7;
+		if (h.type == BLOCK_HUFFMAN and h.table == TABLE_PREVIOUS
+		    and lastTable == SIZE_MAX)
+		{
+			cerr << "Error: block " << blocks.size() << " reuses a table, but "
+			     << "no block before it has one\n";
+			return 7;
+		}
+		if (storesTable(h))
+			lastTable = blocks.size();
+
+		blocks.push_back(blockpos{h, inpos, outpos, lastTable});
+		inpos += h.packsize;
+		outpos += h.rawsize;
+	}
+
+	/* decodes block `i` to `out`, after fetching the lengths it reuses */
+	auto decodeAt = [&](size_t i, uint8_t* out)
+	{
+		const blockpos& b = blocks[i];
+		uint8_t previous[256];
+
+		if (b.h.table == TABLE_PREVIOUS)
+		{
+			const blockpos& t = blocks[b.table];
+			if (readBlockLengths(t.h, in + t.in, previous) == 0)
+				return false;
+		}
+
+		return decodeBlock(b.h, in + b.in, out, blockScratch, user, previous,
+		                   stats);
+	};
+
+	/* output that can't be mapped (a pipe) is written a block at a time */
+	if (!fout.mappable())
+	{
+		vector<uint8_t> outbuf;
+
+		for (size_t i = 0; i < blocks.size() and fout.good(); i++)
+		{
+			outbuf.resize(blocks[i].h.rawsize);
+			if (!decodeAt(i, outbuf.data()))
+			{
+				cerr << "Error: block " << i << " is corrupt\n";
+				return 7;
+			}
+			phasetimer writing(stats, PHASE_WRITE);
+			fout.write(outbuf.data(), outbuf.size());
+		}
+
+		return 0;
+	}
+
+	/* size the output once, so the blocks can be written in any order */
+	uint8_t* out = fout.map(outpos);
+	if (out == nullptr and outpos > 0)
+	{
+		cerr << "Error: failed to size outfile\n";
+		return 8;
+	}
+
+	/* first block that went wrong, if any */
+	std::atomic<size_t> failed(blocks.size());
+	auto task = [&](size_t i)
+	{
+		if (!decodeAt(i, out + blocks[i].out))
+		{
+			size_t first = failed.load();
+			while (i < first and !failed.compare_exchange_weak(first, i))
+				continue;
+		}
+	};
+
+	if (jobs > 1)
+	{
+		threadpool pool(jobs);
+
+		for (size_t i = 0; i < blocks.size(); i++)
+			pool.submit([&task, i] { task(i); });
+
+		pool.wait();
+	}
+	else
+	{
+		for (size_t i = 0; i < blocks.size() and failed == blocks.size(); i++)
+			task(i);
+	}
+
+	if (failed < blocks.size())
+	{
+		cerr << "Error: block " << failed << " is corrupt\n";
+		return 7;
+	}
 
-	tree = getTreeFromHist(histogram);
-	/* readHistogram will leave fin pointing at the end of the histogram
-	 * so consider working from that point, or make sure you "find" the
-	 * end of the histogram section again */
-	readHuffman(tree, fin, fout);
-
-	//Find number of bytes including the histogram  in file
-	fout.seekp(0, fout.end);
-	dStats.numBytes = fout.tellp();
-	fout.seekp(0, fout.beg);
-
-	//Find number of bytes in file (and excluding histogram)
-	fin.clear();
-	fin.seekg(0, fin.end);
-	dStats.numEBytes = fin.tellg() - histogramPosition;
-	dStats.numOverhead = fin.tellg();
-
-	decoderStats();
 	return 0;
 }
 
 
+// Decodes the framed file read from `fd` (typically a pipe) into fout, one
+// block at a time, so that only a single block is ever held in memory.
+// returns 0 on success, or an error code like decode's
+int decodeStream(int fd, outfile& fout, const codetable_t* user,
+                 metrics* stats)
+{
+	vector<uint8_t> inbuf;
+	vector<uint8_t> outbuf;
+	uint8_t header[BLOCK_HEADERSIZE];
+	uint8_t previous[256];
+	bool havePrevious = false;
+	blockheader_t h;
+
+	if (readAll(fd, header, FRAME_HEADERSIZE) != FRAME_HEADERSIZE
+	    or !readFrameHeader(header))
+	{
+		cerr << "Error: unsupported framed file (only framed files can be "
+		     << "read from a pipe)\n";
+		return 6;
+	}
+	stats->add(COUNT_INPUT, FRAME_HEADERSIZE);
+
+	for (size_t blocks = 0; fout.good(); blocks++)
+	{
+		phasetimer reading(stats, PHASE_READ);
+		if (readAll(fd, header, BLOCK_HEADERSIZE) != BLOCK_HEADERSIZE
+		    or !readBlockHeader(header, h))
+		{
+			cerr << "Error: invalid header for block " << blocks << "\n";
+			return 7;
+		}
+		stats->add(COUNT_INPUT, BLOCK_HEADERSIZE);
+
+		if (h.type == BLOCK_END)
+			break;
+		if (!checkTable(h, user, blocks))
+			return 7;
+
+		/* the header's sizes are bounded, but may still be more than this */
+		/* machine can hold */
+		try
+		{
+			inbuf.resize(h.packsize);
+			outbuf.resize(h.rawsize);
+		}
+		catch (const std::bad_alloc&)
+		{
+			cerr << "Error: block " << blocks << " is corrupt\n";
+			return 7;
+		}
+		bool got = readAll(fd, inbuf.data(), h.packsize) == (long)h.packsize;
+		reading.stop();
+		if (!got or !decodeBlock(h, inbuf.data(), outbuf.data(), blockScratch,
+		                         user, havePrevious ? previous : nullptr,
+		                         stats))
+		{
+			cerr << "Error: block " << blocks << " is corrupt\n";
+			return 7;
+		}
+
+		/* later blocks may reuse this one's code */
+		if (storesTable(h))
+			havePrevious = readBlockLengths(h, inbuf.data(), previous) != 0;
+
+		stats->add(COUNT_INPUT, h.packsize);
+		phasetimer writing(stats, PHASE_WRITE);
+		fout.write(outbuf.data(), h.rawsize);
+	}
+
+	return 0;
+}
+
+
+// Decodes just the `len` bytes starting `start` bytes into the original of
+// the framed file fin into fout (fewer if the original ends first). Only the
+// blocks holding them are decoded, found through the file's index if it has
+// one, or else by skipping from block header to block header.
+// returns 0 on success, or an error code like decode's
+int decodeRange(mapfile& fin, outfile& fout, uint64_t start, uint64_t len,
+                const codetable_t* user, metrics* stats)
+{
+	vector<indexentry_t> index;
+	vector<uint8_t> outbuf;
+	const uint8_t* in = fin.data();
+	size_t n = fin.size();
+	blockheader_t h;
+
+	if (n < FRAME_HEADERSIZE or !readFrameHeader(in))
+	{
+		cerr << "Error: unsupported framed file\n";
+		return 6;
+	}
+	if (!readIndex(in, n, index))
+	{
+		cerr << "Error: invalid block header or index\n";
+		return 7;
+	}
+
+	/* the range ends early if the original does */
+	uint64_t total = index.back().rawoffset;
+	uint64_t end = (start < total and len < total - start) ? start + len
+	                                                        : total;
+
+	for (size_t b = findBlock(index, start); start < end and fout.good(); b++)
+	{
+		uint64_t blockstart = index[b].rawoffset;
+		size_t rawsize = index[b + 1].rawoffset - blockstart;
+		size_t skip = start - blockstart;
+		size_t take = min<uint64_t>(end - blockstart, rawsize) - skip;
+
+		/* a block with an unknown table gets a better complaint */
+		if (readBlockHeader(in + index[b].offset, h)
+		    and !checkTable(h, user, b))
+			return 7;
+
+		outbuf.resize(rawsize);
+		if (!decodeIndexedBlock(in, index, b, outbuf.data(), blockScratch,
+		                        user, stats))
+		{
+			cerr << "Error: block " << b << " is corrupt\n";
+			return 7;
+		}
+
+		phasetimer writing(stats, PHASE_WRITE);
+		fout.write(outbuf.data() + skip, take);
+		start += take;
+	}
+
+	return 0;
+}
+
+
+// Makes a table file from the byte counts of every file under `samples` (a
+// file or a directory), so that inputs like them can be coded without a
+// header or a first pass (see --table).
+// returns 0 on success, 1 if the samples can't be read, 4 if there are none
+// or the code is too short for them, or 8 if the table can't be written
+int train(char* samples, char* tablefile, const options& opts)
+{
+	uint64_t hist[256] = {0};
+	size_t files = 0;
+	uint64_t bytes = 0;
+	codetable_t table;
+
+	if (opts.maxbits > TABLE_MAXBITS)
+	{
+		cerr << "Error: table codes are limited to " << TABLE_MAXBITS
+		     << " bits\n";
+		return 4;
+	}
+
+	if (!countSamples(samples, hist, files, bytes))
+		return 1;
+	if (bytes == 0)
+	{
+		cerr << "Error: no samples found in " << samples << "\n";
+		return 4;
+	}
+
+	if (!trainTable(table, opts.tableid, hist, opts.maxbits))
+	{
+		cerr << "Error: " << opts.maxbits << "-bit codes are too short for "
+		     << "every byte\n";
+		return 4;
+	}
+
+	if (!saveTable(tablefile, table))
+	{
+		cerr << "Error encountered while writing table to " << tablefile
+		     << "\n";
+		return 8;
+	}
+
+	/* how well the table fits the samples it was made from */
+	double bits = 0;
+	for (int i = 0; i < 256; i++)
+		bits += (double)hist[i] * table.lengths[i];
+
+	cout << endl << "Huffman Table Trainer" << endl << setfill ('-') << setw(21);
+	cout << "-" << endl << "Read " << bytes << " bytes from " << files;
+	cout << " files in " << samples << endl << "Wrote table " << (int)table.id;
+	cout << " to " << tablefile << endl;
+	cout << "Average bits per symbol in the samples = " << fixed;
+	cout << setprecision(2) << bits / bytes << endl;
+
+	return 0;
+}
+
+
+// Adds the byte counts of the file at `path`, or of every file under it if
+// it's a directory, into `hist`, along with how many files and bytes there
+// were. returns false (after complaining) if anything can't be read
+bool countSamples(const string& path, uint64_t hist[256], size_t& files,
+                  uint64_t& bytes)
+{
+	struct stat st;
+
+	if (stat(path.c_str(), &st) != 0)
+	{
+		cerr << "Error: could not read " << path << "\n";
+		return false;
+	}
+
+	if (S_ISDIR(st.st_mode))
+	{
+		DIR* dir = opendir(path.c_str());
+		bool ok = (dir != nullptr);
+		struct dirent* entry;
+
+		if (!ok)
+			cerr << "Error: could not read " << path << "\n";
+		while (ok and (entry = readdir(dir)) != nullptr)
+		{
+			string name = entry->d_name;
+			string child = path + "/" + name;
+			struct stat link;
+
+			/* links are skipped, so that none can lead round in a loop */
+			if (name == "." or name == ".."
+			    or (lstat(child.c_str(), &link) == 0 and S_ISLNK(link.st_mode)))
+				continue;
+			ok = countSamples(child, hist, files, bytes);
+		}
+
+		if (dir != nullptr)
+			closedir(dir);
+		return ok;
+	}
+
+	/* sockets, devices and so on aren't samples */
+	if (!S_ISREG(st.st_mode))
+		return true;
+
+	mapfile f;
+	if (!f.open(path.c_str()))
+	{
+		cerr << "Error: could not read " << path << "\n";
+		return false;
+	}
+
+	/* countBytes counts in 32 bits, so huge files go a piece at a time */
+	const size_t piece = (size_t)1 << 30;
+	for (size_t pos = 0; pos < f.size(); pos += piece)
+	{
+		uint32_t counts[256] = {0};
+		countBytes(counts, f.data() + pos, min(piece, f.size() - pos));
+		for (int i = 0; i < 256; i++)
+			hist[i] += counts[i];
+	}
+
+	files++;
+	bytes += f.size();
+	return true;
+}
+
+
+// Checks that the table block number `block` (with header `h`) was coded with
+// is one we have: inline, an earlier block's, built in, or `user`. Complains
+// if it isn't.
+// returns true if the block can be decoded
+bool checkTable(const blockheader_t& h, const codetable_t* user, size_t block)
+{
+	if (h.table == TABLE_INLINE or h.table == TABLE_PREVIOUS
+	    or findTable(h.table, user) != nullptr)
+		return true;
+
+	cerr << "Error: block " << block << " was encoded with unknown table "
+	     << (int)h.table << " (pass its table file with --table)\n";
+	return false;
+}
+
+
+// Parses a size such as "4096", "64K" or "1M" (binary multiples),
+// returns 0 if it isn't a valid size
+size_t parseSize(const char* s)
+{
+	char* end;
+	unsigned long long size = strtoull(s, &end, 10);
+
+	switch (*end)
+	{
+		case 'G': case 'g': size <<= 10; /* fall through */
+		case 'M': case 'm': size <<= 10; /* fall through */
+		case 'K': case 'k': size <<= 10; end++; break;
+		case '\0': break;
+		default: return 0;
+	}
+
+	return (*end == '\0' and end != s) ? size : 0;
+}
+
+
+// Parses a range such as "0:4096" or "1G:64K" (a start, which may be 0, and
+// a length, each as parseSize reads them) into `start` and `len`.
+// returns false if it isn't a valid range
+bool parseRange(const char* s, uint64_t& start, uint64_t& len)
+{
+	string range = s;
+	size_t colon = range.find(':');
+
+	if (colon == string::npos)
+		return false;
+
+	string first = range.substr(0, colon);
+	start = (first == "0") ? 0 : parseSize(first.c_str());
+	len = parseSize(range.c_str() + colon + 1);
+
+	return (start > 0 or first == "0") and len > 0;
+}
+
+
+// Parses a comma-separated list of transforms such as "bwt,mtf" into
+// BLOCK_TRANSFORMS flags, returns false if it names anything else, or lists
+// them out of the order delta, bwt, mtf they're always applied in
+bool parseTransforms(const char* s, uint8_t& transforms)
+{
+	string list = s;
+	size_t start = 0;
+
+	transforms = 0;
+	while (start <= list.size())
+	{
+		size_t comma = list.find(',', start);
+		if (comma == string::npos)
+			comma = list.size();
+		string name = list.substr(start, comma - start);
+		uint8_t transform;
+
+		if (name == "delta")
+			transform = BLOCK_DELTA;
+		else if (name == "bwt")
+			transform = BLOCK_BWT;
+		else if (name == "mtf")
+			transform = BLOCK_MTF;
+		else
+			return false;
+
+		/* blocks only record which transforms they went through, and are */
+		/* always put through them in the order of their flags, so the list */
+		/* has to be in that order without repeats */
+		if (transform <= transforms)
+			return false;
+		transforms |= transform;
+		start = comma + 1;
+	}
+
+	return true;
+}
+
+
 string huffcodeToString(huffcode_t c)
 {
 	string s;
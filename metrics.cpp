@@ -0,0 +1,79 @@
+#include <sstream>
+
+#include "metrics.h"
+
+
+/* names of the counters and phases, in enum order */
+static const char* counterNames[COUNT_MAX] = {
+	"input_bytes", "output_bytes", "payload_bytes", "codewords", "blocks",
+	"blocks_new_table", "blocks_reused_table", "blocks_raw", "blocks_context",
+	"blocks_runs", "blocks_transformed"
+};
+static const char* phaseNames[PHASE_MAX] = {
+	"read", "histogram", "tree", "encode", "decode", "transform", "write"
+};
+
+
+metrics::metrics()
+{
+	reset();
+}
+
+uint64_t metrics::get(counter_t c) const
+{
+	return counts[c].load(std::memory_order_relaxed);
+}
+
+uint64_t metrics::time(phase_t p) const
+{
+	return times[p].load(std::memory_order_relaxed);
+}
+
+void metrics::reset()
+{
+	for (int c = 0; c < COUNT_MAX; c++)
+		counts[c].store(0, std::memory_order_relaxed);
+	for (int p = 0; p < PHASE_MAX; p++)
+		times[p].store(0, std::memory_order_relaxed);
+}
+
+// the counters and timers as a JSON object
+std::string metrics::json() const
+{
+	std::ostringstream out;
+
+	out << "{\"counters\": {";
+	for (int c = 0; c < COUNT_MAX; c++)
+		out << (c ? ", " : "") << '"' << counterNames[c] << "\": "
+		    << get((counter_t)c);
+	out << "}, \"phases_ns\": {";
+	for (int p = 0; p < PHASE_MAX; p++)
+		out << (p ? ", " : "") << '"' << phaseNames[p] << "\": "
+		    << time((phase_t)p);
+	out << "}}";
+
+	return out.str();
+}
+
+// hands every counter, then every phase time, to `callback`
+void metrics::report(void (*callback)(const char* name, uint64_t value,
+                                      void* arg), void* arg) const
+{
+	for (int c = 0; c < COUNT_MAX; c++)
+		callback(counterNames[c], get((counter_t)c), arg);
+	for (int p = 0; p < PHASE_MAX; p++)
+	{
+		std::string name = std::string(phaseNames[p]) + "_ns";
+		callback(name.c_str(), time((phase_t)p), arg);
+	}
+}
+
+const char* counterName(counter_t c)
+{
+	return counterNames[c];
+}
+
+const char* phaseName(phase_t p)
+{
+	return phaseNames[p];
+}
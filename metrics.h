@@ -0,0 +1,188 @@
+/// \file metrics.h
+/// \brief defines the counters and phase timers reported by coding runs
+///
+/// A metrics object collects 64-bit counters (bytes in and out, blocks of each
+/// kind, ...) and the time spent in each phase of coding, from any number of
+/// threads at once. Code which can report takes a `metrics*` which may be
+/// null, in which case nothing is counted or timed and the only cost is the
+/// check for null. The results can be written out as JSON, or handed one at a
+/// time to a callback.
+
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+using std::uint64_t;
+
+/// \brief the counters a metrics object keeps
+///
+/// the counters a metrics object keeps
+enum counter_t : int
+{
+	COUNT_INPUT = 0,      ///< bytes read in
+	COUNT_OUTPUT,         ///< bytes written out
+	COUNT_PAYLOAD,        ///< bytes of coded data, without file or block headers
+	COUNT_CODEWORDS,      ///< code words described by stored code headers
+	COUNT_BLOCKS,         ///< blocks coded
+	COUNT_BLOCKS_NEW,     ///< blocks coded with a table of their own
+	COUNT_BLOCKS_REUSED,  ///< blocks coded with an earlier or static table
+	COUNT_BLOCKS_RAW,     ///< blocks stored raw
+	COUNT_BLOCKS_CONTEXT, ///< blocks coded with a context model of their own
+	COUNT_BLOCKS_RUNS,    ///< blocks coded as runs, with a code of their own
+	COUNT_TRANSFORMED,    ///< blocks whose bytes were transformed first
+	COUNT_MAX             ///< number of counters
+};
+
+/// \brief the phases of coding which are timed
+///
+/// the phases of coding which are timed. Phases run by several threads at
+/// once add up the time spent on every thread.
+enum phase_t : int
+{
+	PHASE_READ = 0,  ///< reading input which isn't mapped
+	PHASE_HISTOGRAM, ///< counting bytes
+	PHASE_TREE,      ///< building codes, code trees and decode tables
+	PHASE_ENCODE,    ///< translating bytes to codes
+	PHASE_DECODE,    ///< translating codes to bytes
+	PHASE_TRANSFORM, ///< transforming blocks before coding or after decoding
+	PHASE_WRITE,     ///< writing output out
+	PHASE_MAX        ///< number of phases
+};
+
+/// \brief counters and phase timers which any thread can add to
+///
+/// counters and phase timers which any thread can add to. Additions are
+/// atomic but otherwise unordered, so totals are only meaningful once the
+/// threads adding to them have finished.
+class metrics
+{
+public:
+	/// \brief constructor starts every counter and timer at zero
+	///
+	/// constructor starts every counter and timer at zero
+	metrics();
+
+	/// \brief adds `n` to counter `c`
+	///
+	/// adds `n` to counter `c`
+	void add(counter_t c, uint64_t n)
+	{
+		counts[c].fetch_add(n, std::memory_order_relaxed);
+	}
+
+	/// \brief adds `ns` nanoseconds to the time spent in phase `p`
+	///
+	/// adds `ns` nanoseconds to the time spent in phase `p`
+	void addTime(phase_t p, uint64_t ns)
+	{
+		times[p].fetch_add(ns, std::memory_order_relaxed);
+	}
+
+	/// \brief value of counter `c`
+	///
+	/// value of counter `c`
+	uint64_t get(counter_t c) const;
+
+	/// \brief nanoseconds spent in phase `p`
+	///
+	/// nanoseconds spent in phase `p`
+	uint64_t time(phase_t p) const;
+
+	/// \brief sets every counter and timer back to zero
+	///
+	/// sets every counter and timer back to zero
+	void reset();
+
+	/// \brief the counters and timers as a JSON object
+	///
+	/// the counters and timers as a JSON object, with a "counters" object of
+	/// byte and block counts and a "phases_ns" object of phase times, each
+	/// keyed by the names given by counterName and phaseName
+	std::string json() const;
+
+	/// \brief hands every counter and timer to `callback`
+	///
+	/// calls `callback` once per counter and then once per phase (with the
+	/// phase's name followed by "_ns"), with its name, its value and `arg`
+	void report(void (*callback)(const char* name, uint64_t value, void* arg),
+	            void* arg) const;
+
+private:
+	/// \brief the counters, indexed by counter_t
+	///
+	/// the counters, indexed by counter_t
+	std::atomic<uint64_t> counts[COUNT_MAX];
+	/// \brief nanoseconds spent in each phase, indexed by phase_t
+	///
+	/// nanoseconds spent in each phase, indexed by phase_t
+	std::atomic<uint64_t> times[PHASE_MAX];
+};
+
+/// \brief the name counter `c` is reported under
+///
+/// the name counter `c` is reported under, e.g. "input_bytes"
+const char* counterName(counter_t c);
+
+/// \brief the name phase `p` is reported under
+///
+/// the name phase `p` is reported under, e.g. "histogram"
+const char* phaseName(phase_t p);
+
+/// \brief times a phase from construction until destruction (or stop())
+///
+/// times a phase from construction until destruction or stop(), whichever is
+/// first, and adds the time to a metrics object. With no metrics object the
+/// clock is never read.
+class phasetimer
+{
+public:
+	/// \brief starts timing phase `p` for `m`
+	///
+	/// starts timing phase `p` for `m`, unless `m` is null
+	phasetimer(metrics* m, phase_t p) : m(m), p(p)
+	{
+		if (m != nullptr)
+			start = std::chrono::steady_clock::now();
+	}
+
+	/// \brief stops the timer, if it's still running
+	///
+	/// stops the timer, if it's still running
+	~phasetimer() { stop(); }
+
+	/// \brief adds the time since construction to the phase
+	///
+	/// adds the time since construction to the phase, the first time it's
+	/// called
+	void stop()
+	{
+		if (m == nullptr)
+			return;
+
+		auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+		          std::chrono::steady_clock::now() - start).count();
+		m->addTime(p, ns);
+		m = nullptr;
+	}
+
+private:
+	/// \brief where the time goes, or null once it's been added
+	///
+	/// where the time goes, or null once it's been added
+	metrics* m;
+	/// \brief the phase being timed
+	///
+	/// the phase being timed
+	phase_t p;
+	/// \brief when the timer was started
+	///
+	/// when the timer was started
+	std::chrono::steady_clock::time_point start;
+};
+
+#endif /* METRICS_H */
@@ -0,0 +1,506 @@
+// Microbenchmark for the coding kernels. Runs each stage of coding on its own
+// (counting, building the code, translating to and from codes, transforming
+// blocks) over a few kinds of generated input and reports how many ns it
+// takes per symbol.
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include <sched.h> // sched_setaffinity
+
+#include "canonical.h"
+#include "context.h"
+#include "histogram.h"
+#include "huffcode.h"
+#include "node.h"
+#include "runs.h"
+#include "transform.h"
+
+using namespace std;
+
+/* bytes of input each kernel runs over per pass */
+#define BENCH_SIZE (64 << 20)
+/* keep repeating a kernel for at least this long */
+#define BENCH_SECONDS 0.5
+/* longest code used by the encode and decode kernels, as in a framed file */
+#define BENCH_MAXBITS 15
+/* bytes of input the transform kernels run over per pass, a block at a time */
+/* as in a framed file: sorting all of BENCH_SIZE would take too long */
+#define BENCH_TRANSFORMSIZE (4 << 20)
+/* bytes in each block the transform kernels work on */
+#define BENCH_BLOCKSIZE (1 << 20)
+
+/// \brief a generated input to time the kernels over
+///
+/// a generated input to time the kernels over, along with everything made
+/// from it that the later stages start from, so each stage can be timed on
+/// its own
+struct corpus
+{
+	const char* name;
+	vector<uint8_t> data;
+
+	/* made once by prepare(): the byte counts, the code tree the unframed */
+	/* encoder would build, the length-limited canonical code, the input */
+	/* coded as one stream and as interleaved streams, and decode tables */
+	uint32_t hist[256];
+	node* tree;
+	streamcode_t codes[256];
+	vector<uint8_t> packed;
+	size_t packedsize;
+	vector<uint8_t> streams[INTERLEAVE_STREAMS];
+	decodetable_t table;
+
+	/* and the same for an order-1 context model of CONTEXT_MAXGROUPS groups */
+	contextmodel_t model;
+	streamcode_t contextcodes[CONTEXT_MAXGROUPS][256];
+	vector<uint8_t> contextpacked;
+	size_t contextsize;
+	decodetable_t grouptables[CONTEXT_MAXGROUPS];
+	contexttable_t contexttable;
+
+	/* and the same for the input's run-length form */
+	streamcode_t runcodes[RUN_SYMBOLS];
+	vector<uint8_t> runpacked;
+	size_t runsize;
+	decodetable_t runtable;
+
+	/* and the first BENCH_TRANSFORMSIZE bytes after each transform, with */
+	/* the row bwtEncode returned for each block */
+	vector<uint8_t> deltaed;
+	vector<uint8_t> mtfed;
+	vector<uint8_t> bwted;
+	uint32_t primaries[BENCH_TRANSFORMSIZE / BENCH_BLOCKSIZE];
+
+	/* where the kernels put their results */
+	uint32_t counts[256];
+	uint32_t runcounts[RUN_SYMBOLS];
+	vector<uint32_t> pairs;
+	uint8_t lengths[256];
+	huffcode_t map[256];
+	nodearena arena;
+	pmscratch_t scratch;
+	vector<uint8_t> out;
+	vector<uint8_t> transformed;
+	vector<uint32_t> transformwork;
+};
+
+/// \brief a kernel to time
+///
+/// a kernel to time, and what to call it in the results. `run` runs it once
+/// over `c` and returns the number of symbols it handled: bytes of input for
+/// the kernels which run over the input, and entries in the alphabet (256)
+/// for those which build a code
+struct kernel
+{
+	const char* name;
+	size_t (*run)(corpus& c);
+};
+
+// the straightforward way: one table, one byte at a time
+static void countBytesSimple(uint32_t hist[256], const uint8_t* in, size_t n)
+{
+	for (size_t i = 0; i < n; i++)
+		hist[in[i]]++;
+}
+
+static size_t runHistogramSimple(corpus& c)
+{
+	memset(c.counts, 0, sizeof(c.counts));
+	countBytesSimple(c.counts, c.data.data(), c.data.size());
+	return c.data.size();
+}
+
+static size_t runHistogram(corpus& c)
+{
+	memset(c.counts, 0, sizeof(c.counts));
+	countBytes(c.counts, c.data.data(), c.data.size());
+	return c.data.size();
+}
+
+// the pair counts a context model is built from
+static size_t runContextPairs(corpus& c)
+{
+	c.pairs.assign(256 * 256, 0);
+	countPairs(c.pairs.data(), c.data.data(), c.data.size());
+	return c.data.size();
+}
+
+// the unframed encoder's tree, a node allocated at a time
+static size_t runTree(corpus& c)
+{
+	cleanTree(getTreeFromHist(c.hist));
+	return 256;
+}
+
+static size_t runTreeArena(corpus& c)
+{
+	c.arena.reset();
+	getTreeFromHist(c.hist, &c.arena);
+	return 256;
+}
+
+static size_t runCodeLengths(corpus& c)
+{
+	getLimitedLengths(c.lengths, c.hist, 256, BENCH_MAXBITS, c.scratch);
+	return 256;
+}
+
+static size_t runHuffMap(corpus& c)
+{
+	getHuffMapFromTree(c.map, c.tree);
+	return 256;
+}
+
+// the inner loop of writeHuffman
+static size_t runEncode(corpus& c)
+{
+	encodeCodes(c.codes, c.data.data(), c.data.size(), c.packed.data());
+	return c.data.size();
+}
+
+// the inner loop of readHuffman
+static size_t runDecode(corpus& c)
+{
+	if (!decodeCodes(c.table, c.packed.data(), c.packedsize, c.out.data(),
+	                 c.data.size()))
+		cerr << "Error: " << c.name << " didn't decode\n";
+	return c.data.size();
+}
+
+// the inner loop of a context-coded block
+static size_t runEncodeContext(corpus& c)
+{
+	encodeContextCodes(c.contextcodes, c.model.groups, c.data.data(),
+	                   c.data.size(), c.contextpacked.data());
+	return c.data.size();
+}
+
+static size_t runDecodeContext(corpus& c)
+{
+	if (!decodeContextCodes(c.contexttable, c.contextpacked.data(),
+	                        c.contextsize, c.out.data(), c.data.size()))
+		cerr << "Error: " << c.name << " didn't decode\n";
+	return c.data.size();
+}
+
+// the passes over a block coded as runs
+static size_t runRunsCount(corpus& c)
+{
+	memset(c.runcounts, 0, sizeof(c.runcounts));
+	countRuns(c.runcounts, c.data.data(), c.data.size());
+	return c.data.size();
+}
+
+static size_t runEncodeRuns(corpus& c)
+{
+	encodeRuns(c.runcodes, c.data.data(), c.data.size(), c.runpacked.data());
+	return c.data.size();
+}
+
+static size_t runDecodeRuns(corpus& c)
+{
+	if (!decodeRuns(c.runtable, c.runpacked.data(), c.runsize, c.out.data(),
+	                c.data.size()))
+		cerr << "Error: " << c.name << " didn't decode\n";
+	return c.data.size();
+}
+
+static size_t runDelta(corpus& c)
+{
+	deltaEncode(c.data.data(), BENCH_TRANSFORMSIZE, c.transformed.data());
+	return BENCH_TRANSFORMSIZE;
+}
+
+// undone in place, so each pass starts from a fresh copy
+static size_t runUndelta(corpus& c)
+{
+	memcpy(c.transformed.data(), c.deltaed.data(), BENCH_TRANSFORMSIZE);
+	deltaDecode(c.transformed.data(), BENCH_TRANSFORMSIZE);
+	return BENCH_TRANSFORMSIZE;
+}
+
+static size_t runMtf(corpus& c)
+{
+	mtfEncode(c.data.data(), BENCH_TRANSFORMSIZE, c.transformed.data());
+	return BENCH_TRANSFORMSIZE;
+}
+
+// undone in place, so each pass starts from a fresh copy
+static size_t runUnmtf(corpus& c)
+{
+	memcpy(c.transformed.data(), c.mtfed.data(), BENCH_TRANSFORMSIZE);
+	mtfDecode(c.transformed.data(), BENCH_TRANSFORMSIZE);
+	return BENCH_TRANSFORMSIZE;
+}
+
+static size_t runBwt(corpus& c)
+{
+	for (size_t b = 0; b < BENCH_TRANSFORMSIZE; b += BENCH_BLOCKSIZE)
+		c.primaries[b / BENCH_BLOCKSIZE] = bwtEncode(c.data.data() + b,
+		                                             BENCH_BLOCKSIZE,
+		                                             c.transformed.data() + b,
+		                                             c.transformwork);
+	return BENCH_TRANSFORMSIZE;
+}
+
+static size_t runUnbwt(corpus& c)
+{
+	for (size_t b = 0; b < BENCH_TRANSFORMSIZE; b += BENCH_BLOCKSIZE)
+		if (!bwtDecode(c.bwted.data() + b, BENCH_BLOCKSIZE,
+		               c.primaries[b / BENCH_BLOCKSIZE],
+		               c.transformed.data() + b, c.transformwork))
+			cerr << "Error: " << c.name << " didn't transform back\n";
+	return BENCH_TRANSFORMSIZE;
+}
+
+static size_t runDecodeInterleaved(corpus& c)
+{
+	const uint8_t* in[INTERLEAVE_STREAMS];
+	size_t inlen[INTERLEAVE_STREAMS];
+
+	for (size_t s = 0; s < INTERLEAVE_STREAMS; s++)
+	{
+		in[s] = c.streams[s].data();
+		inlen[s] = c.streams[s].size();
+	}
+
+	if (!decodeCodesInterleaved(c.table, in, inlen, c.out.data(),
+	                            c.data.size()))
+		cerr << "Error: " << c.name << " didn't decode\n";
+	return c.data.size();
+}
+
+// fills `c` with `n` bytes of input of the given kind
+static void generate(corpus& c, size_t n)
+{
+	mt19937 rng(1);
+	string kind = c.name;
+
+	c.data.resize(n);
+	if (kind == "random")
+	{
+		for (size_t i = 0; i < n; i++)
+			c.data[i] = rng();
+	}
+	else if (kind == "text")
+	{
+		/* letters weighted roughly like English, with spaces and newlines */
+		const char* letters = "eeeeeeeeeeeetttttttttaaaaaaaaoooooooiiiiiii"
+		                      "nnnnnnnsssssshhhhhhrrrrrrddddlllluuucccmmmww"
+		                      "ffggyyppbbvk      \n";
+		size_t count = strlen(letters);
+		for (size_t i = 0; i < n; i++)
+			c.data[i] = letters[rng() % count];
+	}
+	else /* a single byte over and over, the worst case for one table */
+		memset(c.data.data(), 'a', n);
+}
+
+// makes everything the later stages of coding start from
+static void prepare(corpus& c)
+{
+	size_t n = c.data.size();
+	huffcode_t map[256];
+	uint8_t lengths[256];
+
+	memset(c.hist, 0, sizeof(c.hist));
+	countBytes(c.hist, c.data.data(), n);
+	c.tree = getTreeFromHist(c.hist);
+
+	getLimitedLengths(lengths, c.hist, 256, BENCH_MAXBITS);
+	getCanonicalMap(map, lengths, 256);
+	getStreamCodes(c.codes, map, 256);
+
+	c.packed.resize((n * BENCH_MAXBITS + 7) / 8 + 8);
+	c.packedsize = encodeCodes(c.codes, c.data.data(), n, c.packed.data());
+
+	for (size_t s = 0; s < INTERLEAVE_STREAMS; s++)
+	{
+		size_t count = (n + INTERLEAVE_STREAMS - 1 - s) / INTERLEAVE_STREAMS;
+		c.streams[s].resize((count * BENCH_MAXBITS + 7) / 8 + 8);
+		c.streams[s].resize(encodeCodes(c.codes, c.data.data() + s, count,
+		                                c.streams[s].data(),
+		                                INTERLEAVE_STREAMS));
+	}
+
+	c.arena.reset();
+	buildDecodeTable(c.table, getTreeFromMap(map, 256, &c.arena));
+	c.out.resize(n);
+
+	c.pairs.assign(256 * 256, 0);
+	countPairs(c.pairs.data(), c.data.data(), n);
+	buildContextModel(c.model, c.pairs.data(), CONTEXT_MAXGROUPS,
+	                  BENCH_MAXBITS, c.scratch);
+	for (size_t g = 0; g < c.model.ngroups; g++)
+	{
+		getCanonicalMap(map, c.model.lengths[g], 256);
+		getStreamCodes(c.contextcodes[g], map, 256);
+		c.arena.reset();
+		buildDecodeTable(c.grouptables[g], getTreeFromMap(map, 256, &c.arena));
+	}
+	buildContextTable(c.contexttable, c.grouptables, c.model.ngroups,
+	                  c.model.groups);
+	c.contextpacked.resize((n * BENCH_MAXBITS + 7) / 8 + 8);
+	c.contextsize = encodeContextCodes(c.contextcodes, c.model.groups,
+	                                   c.data.data(), n,
+	                                   c.contextpacked.data());
+
+	uint8_t runlengths[RUN_SYMBOLS];
+	huffcode_t runmap[RUN_SYMBOLS];
+	memset(c.runcounts, 0, sizeof(c.runcounts));
+	countRuns(c.runcounts, c.data.data(), n);
+	getLimitedLengths(runlengths, c.runcounts, RUN_SYMBOLS, BENCH_MAXBITS);
+	getCanonicalMap(runmap, runlengths, RUN_SYMBOLS);
+	getStreamCodes(c.runcodes, runmap, RUN_SYMBOLS);
+	c.arena.reset();
+	buildDecodeTable(c.runtable, getTreeFromMap(runmap, RUN_SYMBOLS,
+	                                            &c.arena));
+	c.runpacked.resize((n * BENCH_MAXBITS + 7) / 8 + 8);
+	c.runsize = encodeRuns(c.runcodes, c.data.data(), n, c.runpacked.data());
+
+	c.transformed.resize(BENCH_TRANSFORMSIZE);
+	c.deltaed.resize(BENCH_TRANSFORMSIZE);
+	deltaEncode(c.data.data(), BENCH_TRANSFORMSIZE, c.deltaed.data());
+	c.mtfed.resize(BENCH_TRANSFORMSIZE);
+	mtfEncode(c.data.data(), BENCH_TRANSFORMSIZE, c.mtfed.data());
+	c.bwted.resize(BENCH_TRANSFORMSIZE);
+	for (size_t b = 0; b < BENCH_TRANSFORMSIZE; b += BENCH_BLOCKSIZE)
+		c.primaries[b / BENCH_BLOCKSIZE] = bwtEncode(c.data.data() + b,
+		                                             BENCH_BLOCKSIZE,
+		                                             c.bwted.data() + b,
+		                                             c.transformwork);
+}
+
+// runs `k` over `c` until BENCH_SECONDS have passed, returns ns per symbol
+static double timeKernel(const kernel& k, corpus& c)
+{
+	using clock = chrono::steady_clock;
+	size_t symbols = 0;
+	double seconds = 0;
+
+	auto start = clock::now();
+	while (seconds < BENCH_SECONDS)
+	{
+		symbols += k.run(c);
+		seconds = chrono::duration<double>(clock::now() - start).count();
+	}
+
+	return seconds * 1e9 / symbols;
+}
+
+// keeps this thread (the only one) on `cpu`, returns false on failure
+static bool pin(int cpu)
+{
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	return sched_setaffinity(0, sizeof(set), &set) == 0;
+}
+
+static void usage()
+{
+	cerr << "Usage: microbench [--cpu N] [--kernel NAME]\n"
+	        "\nTimes each coding kernel (or just NAME) over random, text-like"
+	        " and single-byte\ninputs, pinned to core N if given, and reports"
+	        " ns per symbol.\n";
+}
+
+int main(int argc, char** argv)
+{
+	kernel kernels[] = {
+		{"histogram-simple", runHistogramSimple},
+		{"histogram", runHistogram},
+		{"tree", runTree},
+		{"tree-arena", runTreeArena},
+		{"code-lengths", runCodeLengths},
+		{"huffmap", runHuffMap},
+		{"encode", runEncode},
+		{"decode", runDecode},
+		{"decode-interleaved", runDecodeInterleaved},
+		{"context-pairs", runContextPairs},
+		{"encode-context", runEncodeContext},
+		{"decode-context", runDecodeContext},
+		{"runs-count", runRunsCount},
+		{"encode-runs", runEncodeRuns},
+		{"decode-runs", runDecodeRuns},
+		{"delta", runDelta},
+		{"undelta", runUndelta},
+		{"mtf", runMtf},
+		{"unmtf", runUnmtf},
+		{"bwt", runBwt},
+		{"unbwt", runUnbwt},
+	};
+	corpus corpora[] = {{"random"}, {"text"}, {"run"}};
+	string only;
+
+	for (int i = 1; i < argc; i++)
+	{
+		string arg = argv[i];
+
+		if (arg == "--cpu" and i + 1 < argc)
+		{
+			int cpu = atoi(argv[++i]);
+			if (!pin(cpu))
+			{
+				cerr << "E: couldn't pin to core " << cpu << "\n";
+				return 1;
+			}
+		}
+		else if (arg == "--kernel" and i + 1 < argc)
+			only = argv[++i];
+		else
+		{
+			usage();
+			return 1;
+		}
+	}
+
+	for (auto& c : corpora)
+	{
+		generate(c, BENCH_SIZE);
+		prepare(c);
+	}
+
+	cout << left << setw(20) << "kernel";
+	for (auto& c : corpora)
+		cout << right << setw(12) << c.name;
+	cout << "   (ns/symbol)" << endl;
+
+	for (auto& k : kernels)
+	{
+		if (not only.empty() and only != k.name)
+			continue;
+
+		cout << left << setw(20) << k.name;
+		for (auto& c : corpora)
+			cout << right << setw(12) << fixed << setprecision(3)
+			     << timeKernel(k, c);
+		cout << endl;
+	}
+
+	/* make sure the results can't be optimized away, and that they're right */
+	auto ran = [&](const string& prefix)
+	{
+		return only.empty() or only.compare(0, prefix.size(), prefix) == 0;
+	};
+	for (auto& c : corpora)
+	{
+		if (ran("histogram") and c.counts[c.data[0]] == 0)
+			cerr << "Error: " << c.name << " miscounted\n";
+		if (ran("decode") and c.out != c.data)
+			cerr << "Error: " << c.name << " decoded wrongly\n";
+		if (ran("un") and memcmp(c.transformed.data(), c.data.data(),
+		                         BENCH_TRANSFORMSIZE) != 0)
+			cerr << "Error: " << c.name << " transformed back wrongly\n";
+		cleanTree(c.tree);
+	}
+
+	return 0;
+}
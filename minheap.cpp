@@ -11,6 +11,16 @@ minheap::minheap()
 }
 
 void minheap::insert(node* n)
+{
+	insert(*n);
+
+	/* if the node passed in wasn't from the "empty spot" on the array stack */
+	/* then clean up its memory footprint from the heap */
+	if (n != array)
+		delete n;
+}
+
+void minheap::insert(const node& n)
 {
 	/* i = index of heap to insert new data */
 	size_t i;
@@ -24,20 +34,15 @@ void minheap::insert(node* n)
 	}
 
 	/* loop while parent node is greater than inserted, and we are't at root */
-	for (i = ++(this->pos); i/2 and n->weight < array[i/2].weight; i/=2)
+	for (i = ++(this->pos); i/2 and n.weight < array[i/2].weight; i/=2)
 		/* move parent node down the heap */
 		array[i] = array[i/2];
 
 	/* we found the spot for our data */
-	array[i].left = n->left;
-	array[i].right = n->right;
-	array[i].weight = n->weight;
-	array[i].ch = n->ch;
-
-	/* if the node passed in wasn't from the "empty spot" on the array stack */
-	/* then clean up its memory footprint from the heap */
-	if (n != array)
-		delete n;
+	array[i].left = n.left;
+	array[i].right = n.right;
+	array[i].weight = n.weight;
+	array[i].ch = n.ch;
 }
 
 void minheap::insert(uint32_t freq, uint8_t ch)
@@ -49,10 +54,12 @@ void minheap::insert(uint32_t freq, uint8_t ch)
 	insert(array);
 }
 
-node* minheap::pop_smallest()
+node* minheap::pop_smallest(nodearena* arena)
 {
 	/* initialize an invalid heap node */
-	node* small = new node;
+	node* small = arena ? arena->alloc() : new node;
+	small->left = nullptr;
+	small->right = nullptr;
 	small->weight = (uint32_t)-1;
 	small->ch = 0;
 
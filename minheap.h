@@ -30,6 +30,11 @@ public:
 	/// insert a dynamically-allocated node into the statically-stored minheap,
 	/// deallocating it after storing it
 	void insert(node*);
+	/// \brief copying node insert function
+	///
+	/// insert a copy of a node into the statically-stored minheap, leaving
+	/// the original alone
+	void insert(const node&);
 	/// \brief statically-allocated node insert function
 	///
 	/// insert a dynamically-allocated node into the statically-stored minheap,
@@ -39,8 +44,9 @@ public:
 	///
 	/// dynamically allocates a node and pops out the minimum node on the heap.
 	/// it's critical that you clean up (dealloc) after getting a node from this
-	/// function! (use cleanTree)
-	node* pop_smallest();
+	/// function! (use cleanTree). If `arena` is given, the node comes from it
+	/// instead, and is cleaned up with the rest of the arena
+	node* pop_smallest(nodearena* arena = nullptr);
 	/// \brief read-only indicator of how many items are in the heap
 	///
 	/// read-only indicator of how many items are in the heap
@@ -5,10 +5,21 @@
 #ifndef NODE_H
 #define NODE_H
 
+#include <cstddef>
 #include <cstdint>
+#include <vector>
+using std::size_t;
 using std::uint32_t;
+using std::uint16_t;
 using std::uint8_t;
 
+/// \brief most nodes a code tree over the 258 symbols of a run-coded block
+/// can have (257 interior), which covers trees over 256 bytes too
+#define ARENA_NODES 515
+/// \brief most nodes a code tree over every 16-bit symbol can have (65535
+/// interior)
+#define ARENA_WIDENODES (2 * 65536 - 1)
+
 /// \brief huffman code tree building block
 ///
 /// Nodes form the data structure for the huffman code tree. They are either
@@ -20,7 +31,8 @@ using std::uint8_t;
 /// variable-lenth sequence of bits which represent the order and direction of
 /// traverses down the tree, where 0 is a left traverse and 1 is a right
 /// traverse. Once a leaf is found, that sequence yields the huffman code
-/// corresponding to the leaf's `ch`.
+/// corresponding to the leaf's `ch`. Trees over 16-bit symbols (see
+/// BLOCK_WIDE) work the same way, with `ch` a 16-bit symbol.
 struct node
 {
 	/// \brief pointer to child of the current node
@@ -44,12 +56,13 @@ struct node
 	/// the characters in the subtrees below.
 	uint32_t weight;
 
-	/// \brief a byte which appears in a source file
+	/// \brief a byte (or 16-bit symbol) which appears in a source file
 	///
-	/// If the node is a leaf, `ch` is a byte, and its location in the tree
-	/// (from the desription of a node) forms its corresponding huffman code.
-	/// If this node is not a leaf, then `ch` has no meaning.
-	uint8_t ch;
+	/// If the node is a leaf, `ch` is a byte, or a 16-bit symbol in a tree
+	/// over that alphabet, and its location in the tree (from the desription
+	/// of a node) forms its corresponding huffman code. If this node is not a
+	/// leaf, then `ch` has no meaning.
+	uint16_t ch;
 
 	/// \brief batman-syndrome-identifier
 	///
@@ -57,4 +70,49 @@ struct node
 	bool isLeaf() { return (left == nullptr) and (right == nullptr); }
 };
 
+/// \brief reusable storage for the nodes of one code tree
+///
+/// holds the nodes of a code tree in place of separately allocated ones, so
+/// that building a tree allocates nothing. It starts with room for
+/// ARENA_NODES nodes, and only grows when asked to with `reserve()`. Trees
+/// built in an arena are thrown away all at once with `reset()`, and must not
+/// be passed to cleanTree.
+struct nodearena
+{
+	/// \brief storage for the nodes
+	///
+	/// storage for the nodes, handed out from the front
+	std::vector<node> nodes = std::vector<node>(ARENA_NODES);
+	/// \brief number of nodes handed out so far
+	///
+	/// number of nodes handed out so far
+	size_t used = 0;
+
+	/// \brief makes room for at least `n` nodes
+	///
+	/// makes room for at least `n` nodes, allocating only the first time the
+	/// arena is asked for that many. Only call it with no tree in the arena
+	void reserve(size_t n)
+	{
+		if (nodes.size() < n)
+			nodes.resize(n);
+	}
+
+	/// \brief hands out a cleared node, or nullptr if the arena is full
+	///
+	/// hands out a cleared node, or nullptr if the arena is full
+	node* alloc()
+	{
+		if (used == nodes.size())
+			return nullptr;
+		nodes[used] = node{nullptr, nullptr, 0, 0};
+		return &nodes[used++];
+	}
+
+	/// \brief throws away every node handed out so far
+	///
+	/// throws away every node handed out so far
+	void reset() { used = 0; }
+};
+
 #endif /* NODE_H */
@@ -0,0 +1,24 @@
+#include "runs.h"
+
+
+// adds the count of each symbol of the run-length form of the `n` bytes at
+// `in` to `hist`, returns the number of symbols
+size_t countRuns(uint32_t hist[RUN_SYMBOLS], const uint8_t* in, size_t n)
+{
+	size_t symbols = 0;
+
+	for (size_t i = 0; i < n; )
+	{
+		size_t run = runLength(in, i, n);
+
+		hist[in[i]]++;
+		symbols++;
+		i += 1 + run;
+
+		/* the digits of the run, least significant first */
+		for (; run; run = (run - 1) >> 1, symbols++)
+			hist[(run & 1) ? RUN_A : RUN_B]++;
+	}
+
+	return symbols;
+}
@@ -0,0 +1,65 @@
+/// \file runs.h
+/// \brief defines the run-length form of a block coded by run-coded blocks
+///
+/// However skewed the input, a Huffman code spends at least a bit on every
+/// byte, so a block made mostly of long runs (a file of one repeated byte, or
+/// a sparse binary full of zeros) can't get much smaller than an eighth of its
+/// size. A run-coded block codes a block's runs instead: each byte is followed
+/// by the number of times it repeats, written in bijective base 2 with two
+/// extra symbols, RUN_A (digit 1) and RUN_B (digit 2), least significant digit
+/// first, as bzip2 does. A run of `r` repeats takes about log2(r) symbols, and
+/// the 256 bytes and the two digits are Huffman coded together as one
+/// alphabet of RUN_SYMBOLS symbols.
+
+
+#ifndef RUNS_H
+#define RUNS_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "bitio.h"
+
+using std::size_t;
+using std::uint8_t;
+using std::uint32_t;
+
+/// \brief the symbol for a digit 1 in a run length
+#define RUN_A 256
+/// \brief the symbol for a digit 2 in a run length
+#define RUN_B 257
+/// \brief number of symbols in the alphabet of a run-coded block
+///
+/// number of symbols in the alphabet of a run-coded block: every byte, then
+/// RUN_A and RUN_B
+#define RUN_SYMBOLS 258
+
+/// \brief number of times the byte at `in[i]` repeats straight after it
+///
+/// number of bytes after `in[i]` (and before `in[n]`) which are the same as
+/// it. Compares 8 bytes at a time, so long runs are found quickly
+inline size_t runLength(const uint8_t* in, size_t i, size_t n)
+{
+	uint64_t pattern = in[i] * 0x0101010101010101ULL;
+	size_t j = i + 1;
+
+	/* most bytes aren't repeated at all */
+	if (j == n or in[j] != in[i])
+		return 0;
+
+	while (n - j >= 8 and load64(in + j) == pattern)
+		j += 8;
+	while (j < n and in[j] == in[i])
+		j++;
+
+	return j - i - 1;
+}
+
+/// \brief adds up the symbols of the run-length form of the `n` bytes at `in`
+///
+/// adds the number of times each of the RUN_SYMBOLS symbols appears in the
+/// run-length form of the `n` bytes at `in` to `hist` (which the caller
+/// zeroes first). returns the number of symbols in the run-length form
+size_t countRuns(uint32_t hist[RUN_SYMBOLS], const uint8_t* in, size_t n);
+
+#endif /* RUNS_H */
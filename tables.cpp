@@ -0,0 +1,187 @@
+#include <cstring>
+
+#include "canonical.h"
+#include "fileio.h"
+#include "huffcode.h"
+#include "tables.h"
+
+
+/* the built-in tables' code lengths were made by counting the bytes of */
+/* typical samples of each kind, adding one to every count so */
+/* that bytes the samples lack still get a (long) code, and limiting the */
+/* result to TABLE_MAXBITS bits */
+static constexpr codetable_t builtins[] =
+{
+	{TABLE_ENGLISH, "english", {
+		15, 15, 15, 15, 15, 15, 15, 15, 15, 13,  6, 15, 14, 15, 15, 15,
+		15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
+		 3, 15,  9, 15, 15, 15, 15, 11,  9,  9, 10, 15,  7,  9,  7, 11,
+		11, 10, 11, 11, 12, 12, 12, 13, 13, 12, 11, 11, 13, 13, 13, 15,
+		15,  8, 10,  8,  9,  8,  9,  9,  9,  8, 14, 13,  8,  9,  8,  8,
+		 9, 14,  8,  8,  8,  9, 11, 10, 13,  9, 14, 14, 15, 14, 15, 11,
+		13,  4,  6,  5,  5,  4,  6,  7,  5,  4, 11,  8,  5,  6,  4,  4,
+		 6, 10,  4,  4,  4,  5,  7,  7,  9,  6, 13, 15, 15, 15, 15, 15,
+		15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
+		15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
+		15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
+		15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
+		15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
+		15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
+		15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
+		15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15
+	}},
+	{TABLE_JSON, "json", {
+		15, 15, 15, 15, 15, 15, 15, 15, 15, 10,  5, 15, 15, 15, 15, 15,
+		15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
+		 2, 12,  4, 12, 11, 10, 12, 13, 12, 12, 11, 10,  5,  7,  6,  7,
+		 8,  7,  8,  9,  8,  9,  9,  9,  9,  9,  6, 13, 12, 10, 12, 12,
+		11,  7,  7,  7, 10, 10, 10, 10, 10,  9, 10, 10, 10, 10, 10, 10,
+		10, 10, 10,  9, 10, 10, 10, 10, 10, 10, 10,  8, 11,  7,  9,  8,
+		12,  5,  7,  6,  7,  5,  8,  7,  7,  6,  8,  8,  7,  7,  6,  6,
+		 6, 10,  6,  6,  5,  7,  8,  9,  9,  8,  9,  8, 12,  8, 12, 15,
+		 9,  9,  9,  9,  9,  9,  9,  9,  9,  9,  9,  9,  9,  9,  9,  9,
+		 9,  9,  9,  9,  9,  9,  9,  9,  9,  9,  9,  9,  9,  9,  9,  9,
+		 9,  9,  9,  9,  9,  9,  9,  9,  9,  9,  9,  9,  9,  9,  9,  9,
+		 9,  9,  9,  9,  9,  9,  9,  9,  9,  9,  9,  9,  9,  9,  9,  9,
+		15, 15, 14, 12, 13, 13, 15, 15, 15, 15, 15, 15, 13, 14, 15, 15,
+		10, 11, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
+		10, 15, 11, 10,  9,  7,  7,  7,  7,  7, 11,  9,  9, 10, 15, 11,
+		 9, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15
+	}},
+	{TABLE_LOGS, "logs", {
+		15, 15, 15, 15, 15, 15, 15, 15, 15, 12,  7, 15, 15, 12, 15, 15,
+		15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
+		 4, 15,  9, 14, 14, 10, 14,  7, 11, 11, 12, 11, 10,  5,  4,  4,
+		 7,  6,  6,  6,  7,  7,  7,  8,  8,  8,  8, 12, 13, 10, 12, 15,
+		13,  7,  9,  8,  6,  7, 10,  9,  9,  7, 12, 11,  7,  7,  7,  8,
+		 8, 15,  9,  6,  9, 10, 11,  9, 11, 11, 10, 10, 10, 10, 12,  6,
+		15,  6,  6,  6,  6,  4,  8,  7,  7,  5, 10,  8,  5,  6,  5,  4,
+		 5, 12,  5,  5,  4,  6,  6, 10,  8,  6, 10, 13, 11, 13,  9, 15,
+		13, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
+		15, 15, 15, 15, 15, 15, 15, 15, 14, 14, 15, 15, 15, 15, 15, 15,
+		15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
+		15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
+		15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
+		15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
+		15, 15, 13, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
+		15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15
+	}},
+};
+
+// returns the built-in table with ID `id`, or nullptr if there is none
+const codetable_t* getStaticTable(uint8_t id)
+{
+	for (const codetable_t& t : builtins)
+		if (t.id == id)
+			return &t;
+	return nullptr;
+}
+
+// returns the built-in table called `name`, or nullptr if there is none
+const codetable_t* getStaticTable(const char* name)
+{
+	for (const codetable_t& t : builtins)
+		if (std::strcmp(t.name, name) == 0)
+			return &t;
+	return nullptr;
+}
+
+// returns the built-in table with ID `id`, or `user` if it has that ID
+const codetable_t* findTable(uint8_t id, const codetable_t* user)
+{
+	if (user != nullptr and user->id == id)
+		return user;
+	return getStaticTable(id);
+}
+
+// returns the length of the longest code in `table`
+int tableMaxBits(const codetable_t& table)
+{
+	int maxbits = 0;
+
+	for (int i = 0; i < 256; i++)
+		if (table.lengths[i] > maxbits)
+			maxbits = table.lengths[i];
+	return maxbits;
+}
+
+// fills `table` with the best code of at most `maxbits` bits for the sample
+// byte counts in `hist`, with a code for every byte. returns false if
+// `maxbits` is too short for that
+bool trainTable(codetable_t& table, uint8_t id, const uint64_t hist[256],
+                int maxbits)
+{
+	uint32_t counts[256];
+	uint64_t total = 0;
+	int shift = 0;
+
+	if (maxbits > TABLE_MAXBITS)
+		return false;
+
+	/* the code builders count in 32 bits, so a big corpus has to be scaled */
+	/* down, keeping the counts' proportions */
+	for (int i = 0; i < 256; i++)
+		total += hist[i];
+	while ((total >> shift) >= (1u << 31))
+		shift++;
+
+	/* one more of everything, so that bytes the samples lack get a code */
+	for (int i = 0; i < 256; i++)
+		counts[i] = (uint32_t)(hist[i] >> shift) + 1;
+
+	table.id = id;
+	table.name = nullptr;
+	return getLimitedLengths(table.lengths, counts, 256, maxbits);
+}
+
+// writes the table file form of `table` to `out`, returns the number of
+// bytes written
+size_t writeTable(const codetable_t& table, uint8_t* out)
+{
+	std::memcpy(out, TABLE_FILEMAGIC, 4);
+	out[4] = TABLE_FILEVERSION;
+	out[5] = table.id;
+
+	return TABLE_FILEHEADERSIZE
+	       + packLengths(table.lengths, 256, out + TABLE_FILEHEADERSIZE);
+}
+
+// writes `table` to a table file at `path`, returns false on failure
+bool saveTable(const char* path, const codetable_t& table)
+{
+	uint8_t buf[TABLE_MAXFILESIZE];
+	size_t n = writeTable(table, buf);
+	outfile f;
+
+	return f.open(path) and f.write(buf, n) and f.close();
+}
+
+// fills `table` from the `n` bytes of a table file at `in`, returns false if
+// the file is malformed or the table isn't one the coders can use
+bool readTable(const uint8_t* in, size_t n, codetable_t& table)
+{
+	if (n < TABLE_FILEHEADERSIZE or std::memcmp(in, TABLE_FILEMAGIC, 4) != 0
+	    or in[4] != TABLE_FILEVERSION or in[5] < TABLE_USERMIN)
+		return false;
+
+	table.id = in[5];
+	table.name = nullptr;
+	if (unpackLengths(in + TABLE_FILEHEADERSIZE, n - TABLE_FILEHEADERSIZE,
+	                  table.lengths, 256) != n - TABLE_FILEHEADERSIZE)
+		return false;
+
+	/* every byte needs a code, or some inputs couldn't be coded at all */
+	for (int i = 0; i < 256; i++)
+		if (table.lengths[i] == 0 or table.lengths[i] > TABLE_MAXBITS)
+			return false;
+
+	return true;
+}
+
+// fills `table` from the table file at `path`
+bool loadTable(const char* path, codetable_t& table)
+{
+	mapfile f;
+
+	return f.open(path) and readTable(f.data(), f.size(), table);
+}
@@ -0,0 +1,123 @@
+/// \file tables.h
+/// \brief defines the static code tables shared by encoder and decoder
+///
+/// A static code table is a set of canonical code lengths which both sides
+/// already know, so that data coded with it needs neither a header describing
+/// its code nor a first pass to count its bytes. A few tables for common kinds
+/// of data are built in; others can be loaded from a table file. Either kind
+/// is named by a one-byte ID, which is all that is stored with the data.
+
+
+#ifndef TABLES_H
+#define TABLES_H
+
+#include <cstddef>
+#include <cstdint>
+
+using std::size_t;
+using std::uint8_t;
+using std::uint64_t;
+
+/// \brief first bytes of a table file
+#define TABLE_FILEMAGIC "HUFT"
+/// \brief version of the table file format written by this program
+#define TABLE_FILEVERSION 1
+/// \brief bytes in a table file before the packed code lengths
+#define TABLE_FILEHEADERSIZE 6
+/// \brief lowest ID a table loaded from a file may have
+///
+/// lowest ID a table loaded from a file may have. IDs below this are reserved
+/// for the built-in tables and the framed format's other table references.
+#define TABLE_USERMIN 0x80
+/// \brief longest code a static table may use
+#define TABLE_MAXBITS 15
+/// \brief largest number of bytes writeTable can produce
+#define TABLE_MAXFILESIZE (TABLE_FILEHEADERSIZE + 256)
+
+/// \brief IDs of the built-in tables
+///
+/// IDs of the built-in tables
+enum statictable_t : uint8_t
+{
+	TABLE_ENGLISH = 0x10, ///< English prose
+	TABLE_JSON = 0x11,    ///< JSON documents
+	TABLE_LOGS = 0x12     ///< line-oriented log files
+};
+
+/// \brief a code table known to both encoder and decoder
+///
+/// a complete canonical code for all 256 byte values, so that any input can
+/// be coded with it, named by `id`
+struct codetable_t
+{
+	/// \brief the ID stored with data coded with this table
+	///
+	/// the ID stored with data coded with this table
+	uint8_t id;
+	/// \brief a short name for the table
+	///
+	/// a short name for the table, which can be used to pick it on the command
+	/// line (nullptr for tables loaded from a file)
+	const char* name;
+	/// \brief the code length of each byte value
+	///
+	/// the code length of each byte value, none of which are 0
+	uint8_t lengths[256];
+};
+
+/// \brief finds the built-in table with the given ID
+///
+/// returns the built-in table with ID `id`, or nullptr if there is none
+const codetable_t* getStaticTable(uint8_t id);
+
+/// \brief finds the built-in table with the given name
+///
+/// returns the built-in table called `name`, or nullptr if there is none
+const codetable_t* getStaticTable(const char* name);
+
+/// \brief finds the table a piece of coded data refers to
+///
+/// returns the built-in table with ID `id`, or `user` if it has that ID, or
+/// nullptr if neither does
+const codetable_t* findTable(uint8_t id, const codetable_t* user);
+
+/// \brief longest code in a table
+///
+/// returns the length of the longest code in `table`
+int tableMaxBits(const codetable_t& table);
+
+/// \brief makes a table from the byte counts of a set of samples
+///
+/// fills `table` with the code which best fits the counts in `hist`, as
+/// totalled over every sample, with codes no longer than `maxbits` (at most
+/// TABLE_MAXBITS) and named `id`. Every byte gets a code, even those the
+/// samples lack. returns false if `maxbits` is too short for that
+bool trainTable(codetable_t& table, uint8_t id, const uint64_t hist[256],
+                int maxbits);
+
+/// \brief writes `table` out in the table file format
+///
+/// writes the table file form of `table` (magic, version, ID, packed code
+/// lengths) to `out`, which must have room for TABLE_MAXFILESIZE bytes.
+/// returns the number of bytes written
+size_t writeTable(const codetable_t& table, uint8_t* out);
+
+/// \brief writes `table` to a table file at `path`
+///
+/// same as writeTable, creating (or replacing) the file at `path`. returns
+/// false on failure
+bool saveTable(const char* path, const codetable_t& table);
+
+/// \brief reads a table from the `n` bytes of a table file at `in`
+///
+/// fills `table` from a table file (magic, version, ID, packed code lengths),
+/// returns false if the file is malformed, its ID is below TABLE_USERMIN, or
+/// its code doesn't cover every byte value within TABLE_MAXBITS
+bool readTable(const uint8_t* in, size_t n, codetable_t& table);
+
+/// \brief reads a table from the table file at `path`
+///
+/// same as readTable, for the file at `path`
+bool loadTable(const char* path, codetable_t& table);
+
+#endif /* TABLES_H */
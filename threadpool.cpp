@@ -0,0 +1,136 @@
+#include "threadpool.h"
+
+/* index of the worker running on this thread, or -1 outside the pool */
+static thread_local long workerIndex = -1;
+/* the pool that worker belongs to */
+static thread_local threadpool* workerPool = nullptr;
+
+
+threadpool::threadpool(size_t nthreads)
+{
+	queued = 0;
+	pending = 0;
+	stopping = false;
+	next = 0;
+
+	if (nthreads < 1)
+		nthreads = 1;
+
+	for (size_t i = 0; i < nthreads; i++)
+		queues.emplace_back(new taskqueue);
+	for (size_t i = 0; i < nthreads; i++)
+		threads.emplace_back(&threadpool::run, this, i);
+}
+
+threadpool::~threadpool()
+{
+	{
+		std::lock_guard<std::mutex> guard(statelock);
+		stopping = true;
+	}
+	wake.notify_all();
+
+	for (auto& t : threads)
+		t.join();
+}
+
+void threadpool::submit(std::function<void()> task)
+{
+	size_t q;
+
+	/* workers keep their own tasks, everyone else deals them out */
+	if (workerPool == this)
+		q = workerIndex;
+	else
+	{
+		std::lock_guard<std::mutex> guard(statelock);
+		q = next++ % queues.size();
+	}
+
+	/* count it first, so it can't be finished before it's counted */
+	{
+		std::lock_guard<std::mutex> guard(statelock);
+		queued++;
+		pending++;
+	}
+
+	{
+		std::lock_guard<std::mutex> guard(queues[q]->lock);
+		queues[q]->tasks.push_back(std::move(task));
+	}
+	wake.notify_one();
+}
+
+void threadpool::wait()
+{
+	std::unique_lock<std::mutex> guard(statelock);
+	idle.wait(guard, [this] { return pending == 0; });
+}
+
+size_t threadpool::size()
+{
+	return threads.size();
+}
+
+void threadpool::run(size_t self)
+{
+	std::function<void()> task;
+
+	workerIndex = self;
+	workerPool = this;
+
+	for (;;)
+	{
+		/* sleep until there's something queued somewhere (or we're done) */
+		{
+			std::unique_lock<std::mutex> guard(statelock);
+			wake.wait(guard, [this] { return queued > 0 or stopping; });
+			if (queued == 0 and stopping)
+				return;
+		}
+
+		/* someone else may have got to it first, so go back to sleep */
+		if (not take(self, task))
+			continue;
+
+		task();
+		task = nullptr;
+
+		std::lock_guard<std::mutex> guard(statelock);
+		if (--pending == 0)
+			idle.notify_all();
+	}
+}
+
+bool threadpool::take(size_t self, std::function<void()>& task)
+{
+	/* newest task from our own queue first, it's likely still in cache */
+	for (size_t i = 0; i < queues.size(); i++)
+	{
+		taskqueue& q = *queues[(self + i) % queues.size()];
+		std::lock_guard<std::mutex> guard(q.lock);
+
+		if (q.tasks.empty())
+			continue;
+
+		/* then the oldest task from someone else's */
+		if (i == 0)
+		{
+			task = std::move(q.tasks.back());
+			q.tasks.pop_back();
+		}
+		else
+		{
+			task = std::move(q.tasks.front());
+			q.tasks.pop_front();
+		}
+		break;
+	}
+
+	if (not task)
+		return false;
+
+	std::lock_guard<std::mutex> guard(statelock);
+	queued--;
+	return true;
+}
@@ -0,0 +1,125 @@
+/// \file threadpool.h
+/// \brief defines a work-stealing pool of worker threads
+///
+/// This file defines a fixed-size pool of threads which run submitted tasks.
+/// Every worker has its own queue of tasks; a worker with nothing left to do
+/// steals from the other end of another worker's queue, so uneven tasks (like
+/// blocks which compress differently) still keep every thread busy.
+
+
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using std::size_t;
+
+/// \brief most threads a pool is started with
+///
+/// most threads a pool is started with, well past any machine's cores but
+/// far short of what the system would refuse to start
+#define THREADPOOL_MAXTHREADS 1024
+
+/// \brief a fixed-size, work-stealing pool of worker threads
+///
+/// a fixed-size pool of worker threads. Tasks are spread over the workers'
+/// queues as they are submitted, and idle workers steal from busy ones.
+class threadpool
+{
+public:
+	/// \brief starts `nthreads` worker threads
+	///
+	/// starts `nthreads` worker threads (at least one)
+	threadpool(size_t nthreads);
+
+	/// \brief finishes every queued task, then stops the workers
+	///
+	/// finishes every queued task, then stops and joins the workers
+	~threadpool();
+
+	/// \brief queues `task` to be run by one of the workers
+	///
+	/// queues `task` to be run by one of the workers. Tasks submitted from a
+	/// worker go on that worker's own queue, others are dealt out in turn.
+	void submit(std::function<void()> task);
+
+	/// \brief waits for every submitted task to finish
+	///
+	/// blocks until every task submitted so far has finished running
+	void wait();
+
+	/// \brief number of worker threads
+	///
+	/// number of worker threads
+	size_t size();
+
+private:
+	/// \brief a worker's queue of tasks
+	///
+	/// a worker's queue of tasks. The owner takes from the back (newest
+	/// first), thieves take from the front (oldest first).
+	struct taskqueue
+	{
+		std::mutex lock;
+		std::deque<std::function<void()>> tasks;
+	};
+
+	/// \brief one queue per worker
+	///
+	/// one queue per worker, indexed the same as `threads`
+	std::vector<std::unique_ptr<taskqueue>> queues;
+	/// \brief the worker threads
+	///
+	/// the worker threads
+	std::vector<std::thread> threads;
+
+	/// \brief guards the counters below, and idle workers wait on it
+	///
+	/// guards `queued`, `pending` and `stopping`
+	std::mutex statelock;
+	/// \brief signalled when there is work to do or the pool is stopping
+	///
+	/// signalled when there is work to do or the pool is stopping
+	std::condition_variable wake;
+	/// \brief signalled when the last pending task finishes
+	///
+	/// signalled when the last pending task finishes
+	std::condition_variable idle;
+	/// \brief tasks sitting in a queue
+	///
+	/// tasks sitting in a queue, not yet taken by a worker
+	size_t queued;
+	/// \brief tasks submitted but not yet finished
+	///
+	/// tasks submitted but not yet finished
+	size_t pending;
+	/// \brief set when the workers should exit
+	///
+	/// set when the workers should exit once the queues are empty
+	bool stopping;
+	/// \brief queue the next task from outside the pool goes on
+	///
+	/// queue the next task from outside the pool goes on
+	size_t next;
+
+	/// \brief main loop of worker `self`
+	///
+	/// main loop of worker `self`: take a task, run it, repeat
+	void run(size_t self);
+
+	/// \brief takes a task for worker `self`, from its own queue or another's
+	///
+	/// takes a task for worker `self`, from the back of its own queue or else
+	/// from the front of another worker's. returns false if every queue is
+	/// empty
+	bool take(size_t self, std::function<void()>& task);
+};
+
+#endif /* THREADPOOL_H */
@@ -0,0 +1,213 @@
+#include <algorithm>
+#include <cstring>
+
+#include "transform.h"
+
+
+// writes the difference between each byte and the one before it to `out`
+void deltaEncode(const uint8_t* in, size_t n, uint8_t* out)
+{
+	uint8_t last = 0;
+
+	for (size_t i = 0; i < n; i++)
+	{
+		uint8_t c = in[i];
+		out[i] = c - last;
+		last = c;
+	}
+}
+
+// replaces each difference at `buf` with the running total of them
+void deltaDecode(uint8_t* buf, size_t n)
+{
+	uint8_t last = 0;
+
+	for (size_t i = 0; i < n; i++)
+		last = buf[i] += last;
+}
+
+// writes the position of each byte in a move-to-front list to `out`
+void mtfEncode(const uint8_t* in, size_t n, uint8_t* out)
+{
+	uint8_t rank[256];
+
+	for (int i = 0; i < 256; i++)
+		rank[i] = i;
+
+	/* rather than the list, keep where each byte is in it: moving a byte */
+	/* to the front moves every byte ahead of it back one, which is a pass */
+	/* over all 256 without a branch, so it takes as long however far back */
+	/* the byte was */
+	for (size_t i = 0; i < n; i++)
+	{
+		uint8_t c = in[i];
+		uint8_t r = rank[c];
+
+		for (int b = 0; b < 256; b++)
+			rank[b] += rank[b] < r;
+		rank[c] = 0;
+		out[i] = r;
+	}
+}
+
+// replaces each position at `buf` with the byte at it in a move-to-front list
+void mtfDecode(uint8_t* buf, size_t n)
+{
+	uint8_t order[256];
+
+	for (int i = 0; i < 256; i++)
+		order[i] = i;
+
+	for (size_t i = 0; i < n; i++)
+	{
+		uint8_t j = buf[i];
+		uint8_t c = order[j];
+
+		std::memmove(order + 1, order, j);
+		order[0] = c;
+		buf[i] = c;
+	}
+}
+
+// the symbol at `i` of the `n` bytes at `in` followed by an end marker: 0 for
+// the marker, and one more than the byte for the rest
+static inline uint32_t symbolAt(const uint8_t* in, size_t n, size_t i)
+{
+	return i < n ? in[i] + 1 : 0;
+}
+
+// sorts the rotations of the `n` bytes at `in` and an end marker by prefix
+// doubling, and writes the byte before each to `out`, returns the row of the
+// rotation starting at the first byte
+uint32_t bwtEncode(const uint8_t* in, size_t n, uint8_t* out,
+                   std::vector<uint32_t>& work)
+{
+	size_t len = n + 1;
+	size_t buckets = std::max(len, (size_t)257);
+	size_t classes = 0;
+	uint32_t primary = 0;
+
+	work.resize(4 * len + buckets);
+	uint32_t* sorted = work.data();    /* rotations, by their first h symbols */
+	uint32_t* rank = sorted + len;     /* the class of each rotation */
+	uint32_t* shifted = rank + len;    /* rotations, by their second h */
+	uint32_t* ranked = shifted + len;  /* the classes being worked out */
+	uint32_t* count = ranked + len;    /* where each class goes next */
+
+	/* sort the rotations by their first symbol */
+	std::fill(count, count + 257, 0);
+	for (size_t i = 0; i < len; i++)
+		count[symbolAt(in, n, i)]++;
+	for (size_t s = 0, total = 0; s < 257; s++)
+	{
+		size_t c = count[s];
+		count[s] = total;
+		total += c;
+	}
+	for (size_t i = 0; i < len; i++)
+		sorted[count[symbolAt(in, n, i)]++] = i;
+	for (size_t i = 0; i < len; i++)
+	{
+		if (i == 0 or symbolAt(in, n, sorted[i])
+		              != symbolAt(in, n, sorted[i - 1]))
+			classes++;
+		rank[sorted[i]] = classes - 1;
+	}
+
+	/* then, while any two are still tied, by twice as many: the rotations */
+	/* starting h earlier than those already sorted come sorted by their */
+	/* second h symbols, so a stable sort by their first h finishes them. */
+	/* every rotation is different, since only one has the end marker */
+	for (size_t h = 1; classes < len; h *= 2)
+	{
+		for (size_t i = 0; i < len; i++)
+			shifted[i] = sorted[i] >= h ? sorted[i] - h : sorted[i] + len - h;
+
+		std::fill(count, count + classes, 0);
+		for (size_t i = 0; i < len; i++)
+			count[rank[shifted[i]]]++;
+		for (size_t r = 0, total = 0; r < classes; r++)
+		{
+			size_t c = count[r];
+			count[r] = total;
+			total += c;
+		}
+		for (size_t i = 0; i < len; i++)
+			sorted[count[rank[shifted[i]]]++] = shifted[i];
+
+		classes = 0;
+		for (size_t i = 0; i < len; i++)
+		{
+			size_t a = sorted[i];
+			size_t a2 = a + h < len ? a + h : a + h - len;
+			if (i == 0)
+				classes++;
+			else
+			{
+				size_t b = sorted[i - 1];
+				size_t b2 = b + h < len ? b + h : b + h - len;
+				if (rank[a] != rank[b] or rank[a2] != rank[b2])
+					classes++;
+			}
+			ranked[a] = classes - 1;
+		}
+		std::swap(rank, ranked);
+	}
+
+	/* the byte before each rotation, but for the one before the first byte */
+	for (size_t r = 0, i = 0; r < len; r++)
+	{
+		if (sorted[r] == 0)
+			primary = r;
+		else
+			out[i++] = in[sorted[r] - 1];
+	}
+
+	return primary;
+}
+
+// rebuilds the `n` bytes bwtEncode turned into those at `in` by following each
+// rotation to the one starting a byte later, returns false if `primary` isn't
+// a row
+bool bwtDecode(const uint8_t* in, size_t n, uint32_t primary, uint8_t* out,
+               std::vector<uint32_t>& next)
+{
+	uint32_t start[256] = {0};
+
+	/* the end marker's row is the first, and it has no byte in `in` */
+	if (n == 0)
+		return primary == 0;
+	if (primary < 1 or primary > n)
+		return false;
+
+	/* rotations starting with each byte come after those starting with */
+	/* smaller ones, and after the one starting with the end marker */
+	for (size_t i = 0; i < n; i++)
+		start[in[i]]++;
+	for (size_t c = 0, total = 1; c < 256; c++)
+	{
+		size_t count = start[c];
+		start[c] = total;
+		total += count;
+	}
+
+	/* the k-th row ending in a byte is the k-th starting with it, a byte */
+	/* earlier; turning that around gives each row the row a byte later */
+	next.resize(n + 1);
+	next[0] = primary;
+	for (size_t r = 0; r < primary; r++)
+		next[start[in[r]]++] = r;
+	for (size_t r = primary + 1; r <= n; r++)
+		next[start[in[r - 1]]++] = r;
+
+	/* the row starting with the first byte is `primary`, and each row */
+	/* ends in the byte before the next row's start */
+	uint32_t row = primary;
+	for (size_t i = 0; i < n; i++)
+	{
+		row = next[row];
+		out[i] = in[row - (row >= primary)];
+	}
+
+	return true;
+}
@@ -0,0 +1,71 @@
+/// \file transform.h
+/// \brief defines the reversible transforms a block can go through before
+/// it's coded
+///
+/// A Huffman code only sees how often each byte turns up, not where. A
+/// transform rearranges or re-expresses a block's bytes, without changing
+/// how many there are, so that more of its structure shows up in those
+/// counts: delta coding turns slowly changing numbers into small
+/// differences, the Burrows-Wheeler transform sorts bytes by what follows
+/// them so that bytes seen in the same places end up next to each other, and
+/// move-to-front turns bytes seen recently into small numbers. Each one has
+/// an inverse which gives the block back exactly.
+
+
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+using std::size_t;
+using std::uint8_t;
+using std::uint32_t;
+
+/// \brief replaces each byte with its difference from the byte before
+///
+/// writes the difference (mod 256) between each of the `n` bytes at `in`
+/// and the byte before it (0 for the first) to `out`, which may be `in`
+void deltaEncode(const uint8_t* in, size_t n, uint8_t* out);
+
+/// \brief undoes deltaEncode in place
+///
+/// replaces each of the `n` differences at `buf` with the running total of
+/// them, which gives back the bytes deltaEncode was given
+void deltaDecode(uint8_t* buf, size_t n);
+
+/// \brief replaces each byte with how recently it was last seen
+///
+/// writes, for each of the `n` bytes at `in`, its position in a list of
+/// the 256 byte values which starts in order and has each byte moved to the
+/// front once it's been seen, to `out`, which may be `in`. A byte repeated
+/// becomes a 0, and a byte seen a little earlier a small number
+void mtfEncode(const uint8_t* in, size_t n, uint8_t* out);
+
+/// \brief undoes mtfEncode in place
+///
+/// replaces each of the `n` positions at `buf` with the byte mtfEncode found
+/// there, keeping the same list
+void mtfDecode(uint8_t* buf, size_t n);
+
+/// \brief the Burrows-Wheeler transform of a block
+///
+/// sorts every rotation of the `n` bytes at `in` followed by an end marker
+/// (which sorts before any byte), and writes the byte before each rotation's
+/// start to `out` (which must not be `in`), in sorted order and leaving out
+/// the end marker. `work` is grown as needed to hold the sort. returns the
+/// row the end marker was left out of, which bwtDecode needs
+uint32_t bwtEncode(const uint8_t* in, size_t n, uint8_t* out,
+                   std::vector<uint32_t>& work);
+
+/// \brief undoes bwtEncode
+///
+/// writes the `n` bytes which bwtEncode turned into the `n` at `in`, given
+/// the row `primary` it returned, to `out` (which must not be `in`). `next`
+/// is grown as needed to hold where each row leads. returns false if
+/// `primary` isn't a row bwtEncode could have returned
+bool bwtDecode(const uint8_t* in, size_t n, uint32_t primary, uint8_t* out,
+               std::vector<uint32_t>& next);
+
+#endif /* TRANSFORM_H */